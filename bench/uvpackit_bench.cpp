@@ -0,0 +1,635 @@
+// Benchmarks for the stages of uvp.pack that run outside of UV Packmaster,
+// gathering, validation, island instancing, static island proxies, solving
+// texcoords and writing them back. Meshes are generated in memory and accessed
+// through SyntheticMeshAccessT, which has the same interface as ModoMeshAccessT
+// in uvpackit.cpp.
+//
+// usage: uvpackit_bench [--scale <float>] [--repeat <n>] [--out <file>] [--baseline <file>]
+//
+// Results are written as a flat json object, which can be given back as the
+// baseline of a later run. When a baseline is given, the run fails if a stage
+// is slower or allocates more than the baseline allows, or if none of its
+// values match a stage that ran. The run says how many values it compared.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <new>
+
+#include "uvp_stages.hpp"
+
+// Allocation tracking, every allocation made through operator new is prefixed
+// with its size so peak usage can be measured per stage. Allocations made
+// inside uvpcore are not seen here when it lives in its own dll.
+
+static std::atomic<size_t> g_AllocatedBytes(0);
+static std::atomic<size_t> g_PeakBytes(0);
+
+static const size_t kAllocHeader = 16; // keeps the returned pointer 16 byte aligned
+
+void* operator new(size_t size)
+{
+	void* block = std::malloc(size + kAllocHeader);
+	if (!block)
+		throw std::bad_alloc();
+
+	*static_cast<size_t*>(block) = size;
+
+	size_t current = g_AllocatedBytes += size;
+	size_t peak = g_PeakBytes;
+	while (current > peak && !g_PeakBytes.compare_exchange_weak(peak, current))
+		;
+
+	return static_cast<char*>(block) + kAllocHeader;
+}
+
+void operator delete(void* ptr) noexcept
+{
+	if (!ptr)
+		return;
+
+	void* block = static_cast<char*>(ptr) - kAllocHeader;
+	g_AllocatedBytes -= *static_cast<size_t*>(block);
+	std::free(block);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* ptr) noexcept { operator delete(ptr); }
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { operator delete(ptr); }
+
+// Start measuring peak usage from the current allocation level,
+void resetPeak()
+{
+	g_PeakBytes = g_AllocatedBytes.load();
+}
+
+// In memory stand-in for a Modo mesh layer. Uvs are stored per polygon corner,
+// same as a discontinuous uv map in Modo.
+struct SyntheticLayerT
+{
+	std::vector<unsigned> m_PolyStart;	// first corner of each polygon, plus one past the end
+	std::vector<unsigned> m_PolyPoints;	// point index for each corner
+	std::vector<float> m_CornerUVs;		// two floats per corner
+	std::vector<float> m_PointPos;		// three floats per point
+	std::vector<char> m_Selected;
+	std::vector<char> m_Hidden;
+
+	// Polygons of each generated island, used to build fake packing solutions,
+	std::vector<std::vector<unsigned>> m_Islands;
+
+	// Offsets making point and polygon ids unique across layers,
+	uintptr_t m_PointIdBase = 0;
+	uintptr_t m_PolygonIdBase = 0;
+
+	unsigned polygonCount() const { return (unsigned)m_PolyStart.size() - 1; }
+	unsigned cornerCount() const { return (unsigned)m_PolyPoints.size(); }
+
+	unsigned addPoint(float x, float y, float z)
+	{
+		m_PointPos.push_back(x);
+		m_PointPos.push_back(y);
+		m_PointPos.push_back(z);
+		return (unsigned)m_PointPos.size() / 3 - 1;
+	}
+
+	// Add a polygon given its points and the uv of each corner,
+	unsigned addPolygon(std::initializer_list<unsigned> points, std::initializer_list<float> uvs)
+	{
+		if (m_PolyStart.empty())
+			m_PolyStart.push_back(0);
+
+		m_PolyPoints.insert(m_PolyPoints.end(), points.begin(), points.end());
+		m_CornerUVs.insert(m_CornerUVs.end(), uvs.begin(), uvs.end());
+		m_PolyStart.push_back((unsigned)m_PolyPoints.size());
+		m_Selected.push_back(1);
+		m_Hidden.push_back(0);
+		return polygonCount() - 1;
+	}
+
+	LXtPointID pointID(unsigned index) const { return reinterpret_cast<LXtPointID>(m_PointIdBase + index + 1); }
+	unsigned pointIndex(LXtPointID id) const { return (unsigned)(reinterpret_cast<uintptr_t>(id) - m_PointIdBase - 1); }
+	LXtPolygonID polygonID(unsigned index) const { return reinterpret_cast<LXtPolygonID>(m_PolygonIdBase + index + 1); }
+};
+
+// Accessor wrapper with the interface gatherLayer and writeLayer expect,
+class SyntheticMeshAccessT
+{
+	SyntheticLayerT& m_Layer;
+	unsigned m_Polygon = 0;
+
+	// Corner of the current polygon using the given point,
+	unsigned cornerOf(LXtPointID point_id) const
+	{
+		unsigned point = m_Layer.pointIndex(point_id);
+		for (unsigned c = m_Layer.m_PolyStart[m_Polygon]; c < m_Layer.m_PolyStart[m_Polygon + 1]; c++)
+			if (m_Layer.m_PolyPoints[c] == point)
+				return c;
+		return ~0u;
+	}
+
+public:
+	SyntheticMeshAccessT(SyntheticLayerT& layer) : m_Layer(layer) {}
+
+	unsigned polygonCount() { return m_Layer.polygonCount(); }
+	void selectPolygon(unsigned index) { m_Polygon = index; }
+	LXtPolygonID polygonID() { return m_Layer.polygonID(m_Polygon); }
+	bool polygonHidden() { return m_Layer.m_Hidden[m_Polygon] != 0; }
+	bool polygonSelected() { return m_Layer.m_Selected[m_Polygon] != 0; }
+	unsigned vertexCount() { return m_Layer.m_PolyStart[m_Polygon + 1] - m_Layer.m_PolyStart[m_Polygon]; }
+	LXtPointID vertexByIndex(unsigned index) { return m_Layer.pointID(m_Layer.m_PolyPoints[m_Layer.m_PolyStart[m_Polygon] + index]); }
+	const char* polygonTag(LXtID4) { return nullptr; }
+
+	bool evaluateUV(LXtPointID point_id, LXtFVector2 texcoords)
+	{
+		unsigned corner = cornerOf(point_id);
+		if (corner == ~0u)
+			return false;
+
+		texcoords[0] = m_Layer.m_CornerUVs[corner * 2 + 0];
+		texcoords[1] = m_Layer.m_CornerUVs[corner * 2 + 1];
+		return true;
+	}
+
+	void position(LXtPointID point_id, LXtFVector position)
+	{
+		unsigned point = m_Layer.pointIndex(point_id);
+		position[0] = m_Layer.m_PointPos[point * 3 + 0];
+		position[1] = m_Layer.m_PointPos[point * 3 + 1];
+		position[2] = m_Layer.m_PointPos[point * 3 + 2];
+	}
+
+	void setUV(LXtPointID point_id, const LXtFVector2 texcoords)
+	{
+		unsigned corner = cornerOf(point_id);
+		m_Layer.m_CornerUVs[corner * 2 + 0] = texcoords[0];
+		m_Layer.m_CornerUVs[corner * 2 + 1] = texcoords[1];
+	}
+};
+
+typedef std::vector<SyntheticLayerT> SyntheticSceneT;
+
+// Small deterministic random generator, so every run sees the same meshes.
+struct RandomT
+{
+	uint32_t m_State;
+	RandomT(uint32_t seed) : m_State(seed) {}
+
+	float next()
+	{
+		m_State = m_State * 1664525u + 1013904223u;
+		return (m_State >> 8) * (1.0f / 16777216.0f);
+	}
+};
+
+// One large grid of quads sharing all points, mapped as a single island.
+void addGrid(SyntheticLayerT& layer, unsigned size, float u0, float v0, float extent)
+{
+	unsigned first = (unsigned)layer.m_PointPos.size() / 3;
+	for (unsigned y = 0; y <= size; y++)
+		for (unsigned x = 0; x <= size; x++)
+			layer.addPoint((float)x, 0.0f, (float)y);
+
+	const float step = extent / size;
+	std::vector<unsigned> island;
+	island.reserve(size * size);
+	for (unsigned y = 0; y < size; y++)
+	{
+		for (unsigned x = 0; x < size; x++)
+		{
+			// Computed the same way for every corner, so neighbours share uvs exactly
+			unsigned p0 = first + y * (size + 1) + x;
+			float ua = u0 + x * step, ub = u0 + (x + 1) * step;
+			float va = v0 + y * step, vb = v0 + (y + 1) * step;
+			island.push_back(layer.addPolygon(
+				{ p0, p0 + 1, p0 + size + 2, p0 + size + 1 },
+				{ ua, va, ub, va, ub, vb, ua, vb }));
+		}
+	}
+	layer.m_Islands.push_back(std::move(island));
+}
+
+// Photogrammetry style, many small islands of jittered triangles.
+void addFragments(SyntheticLayerT& layer, unsigned islandCount, unsigned trianglesPerIsland, RandomT& random)
+{
+	for (unsigned i = 0; i < islandCount; i++)
+	{
+		float cu = random.next();
+		float cv = random.next();
+		float size = 0.002f + random.next() * 0.004f;
+
+		// Triangle strip, each triangle shares an edge with the previous one,
+		std::vector<unsigned> points;
+		std::vector<float> uvs;
+		for (unsigned p = 0; p < trianglesPerIsland + 2; p++)
+		{
+			float u = cu + (p / 2) * size + random.next() * size * 0.25f;
+			float v = cv + (p % 2) * size + random.next() * size * 0.25f;
+			points.push_back(layer.addPoint(u * 100.0f, random.next(), v * 100.0f));
+			uvs.push_back(u);
+			uvs.push_back(v);
+		}
+
+		std::vector<unsigned> island;
+		for (unsigned t = 0; t < trianglesPerIsland; t++)
+		{
+			island.push_back(layer.addPolygon(
+				{ points[t], points[t + 1], points[t + 2] },
+				{ uvs[t * 2], uvs[t * 2 + 1], uvs[t * 2 + 2], uvs[t * 2 + 3], uvs[t * 2 + 4], uvs[t * 2 + 5] }));
+		}
+		layer.m_Islands.push_back(std::move(island));
+	}
+}
+
+// Kitbash style prop, a box where every side is its own uv island. Every box
+// uses the same uv layout, as repeated bolts and panels would.
+void addBox(SyntheticLayerT& layer, float x, float y, float z)
+{
+	unsigned p[8];
+	for (unsigned i = 0; i < 8; i++)
+		p[i] = layer.addPoint(x + (i & 1), y + ((i >> 1) & 1), z + ((i >> 2) & 1));
+
+	const unsigned sides[6][4] = {
+		{ 0, 1, 3, 2 }, { 4, 6, 7, 5 }, { 0, 4, 5, 1 },
+		{ 2, 3, 7, 6 }, { 0, 2, 6, 4 }, { 1, 5, 7, 3 },
+	};
+	for (unsigned s = 0; s < 6; s++)
+	{
+		float u = (s % 3) * 0.3f;
+		float v = (s / 3) * 0.3f;
+		layer.m_Islands.push_back({ layer.addPolygon(
+			{ p[sides[s][0]], p[sides[s][1]], p[sides[s][2]], p[sides[s][3]] },
+			{ u, v, u + 0.25f, v, u + 0.25f, v + 0.25f, u, v + 0.25f }) });
+	}
+}
+
+// Give every layer its own range of ids, as Modo ids are unique pointers.
+void assignIds(SyntheticSceneT& scene)
+{
+	uintptr_t pointBase = 0;
+	uintptr_t polygonBase = 0;
+	for (SyntheticLayerT& layer : scene)
+	{
+		layer.m_PointIdBase = pointBase;
+		layer.m_PolygonIdBase = polygonBase;
+		pointBase += layer.m_PointPos.size() / 3 + 1;
+		polygonBase += layer.polygonCount() + 1;
+	}
+}
+
+struct BenchCaseT
+{
+	std::string m_Name;
+	SyntheticSceneT m_Scene;
+};
+
+std::vector<BenchCaseT> buildCorpus(float scale)
+{
+	std::vector<BenchCaseT> corpus;
+	RandomT random(1234);
+
+	auto scaled = [scale](unsigned value) { return std::max(1u, (unsigned)(value * scale)); };
+
+	// A single dense grid, ~1M quads at scale 1
+	{
+		BenchCaseT bench{ "grid" };
+		bench.m_Scene.resize(1);
+		addGrid(bench.m_Scene[0], scaled(1000), 0.0f, 0.0f, 1.0f);
+		corpus.push_back(std::move(bench));
+	}
+
+	// Heavily fragmented scan, 100k islands of 6 triangles
+	{
+		BenchCaseT bench{ "fragments" };
+		bench.m_Scene.resize(1);
+		addFragments(bench.m_Scene[0], scaled(100000), 6, random);
+		corpus.push_back(std::move(bench));
+	}
+
+	// Kitbash scene, 64 layers of repeated boxes
+	{
+		BenchCaseT bench{ "kitbash" };
+		bench.m_Scene.resize(64);
+		for (SyntheticLayerT& layer : bench.m_Scene)
+			for (unsigned i = 0; i < scaled(2000); i++)
+				addBox(layer, (float)(i % 50) * 2.0f, 0.0f, (float)(i / 50) * 2.0f);
+		corpus.push_back(std::move(bench));
+	}
+
+	// Partial selection, a small patch of a dense grid selected. The grid is a
+	// single island, so UVP still moves all of it and nothing is left static.
+	{
+		BenchCaseT bench{ "partial" };
+		bench.m_Scene.resize(1);
+		SyntheticLayerT& layer = bench.m_Scene[0];
+		unsigned size = scaled(1000);
+		addGrid(layer, size, 0.0f, 0.0f, 1.0f);
+		for (unsigned i = 0; i < layer.polygonCount(); i++)
+			layer.m_Selected[i] = (i % size) < size / 10 && (i / size) < size / 10;
+		corpus.push_back(std::move(bench));
+	}
+
+	// Pack to others, a small selected grid next to 16 dense unselected grids,
+	// ~1M quads at scale 1. The unselected grids are separate static islands,
+	// which the proxy stage replaces with their hulls.
+	{
+		BenchCaseT bench{ "static" };
+		bench.m_Scene.resize(1);
+		SyntheticLayerT& layer = bench.m_Scene[0];
+		for (unsigned i = 0; i < 16; i++)
+			addGrid(layer, scaled(250), (i % 4) * 0.25f, (i / 4) * 0.25f, 0.2f);
+		std::fill(layer.m_Selected.begin(), layer.m_Selected.end(), 0);
+		addGrid(layer, scaled(20), 0.9f, 0.9f, 0.05f);
+		corpus.push_back(std::move(bench));
+	}
+
+	for (BenchCaseT& bench : corpus)
+		assignIds(bench.m_Scene);
+
+	return corpus;
+}
+
+struct StageResultT
+{
+	double m_CornersPerSec = 0.0;
+	size_t m_PeakBytes = 0;
+};
+
+// Run a stage repeat times, keeping the fastest run and the largest peak,
+template <typename SetupT, typename StageT>
+StageResultT measure(unsigned repeat, size_t corners, SetupT setup, StageT stage)
+{
+	StageResultT result;
+	for (unsigned i = 0; i < repeat; i++)
+	{
+		setup();
+		resetPeak();
+		size_t base = g_AllocatedBytes;
+
+		auto start = std::chrono::steady_clock::now();
+		stage();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		double rate = corners / std::max(elapsed.count(), 1e-9);
+		result.m_CornersPerSec = std::max(result.m_CornersPerSec, rate);
+		result.m_PeakBytes = std::max(result.m_PeakBytes, g_PeakBytes - base);
+	}
+	return result;
+}
+
+void runCase(BenchCaseT& bench, unsigned repeat, std::map<std::string, double>& results)
+{
+	size_t corners = 0;
+	for (const SyntheticLayerT& layer : bench.m_Scene)
+		corners += layer.cornerCount();
+
+	UvGatherT gather;
+	std::vector<std::vector<int>> islands;
+	std::vector<UvpIslandPackSolutionT> solutions;
+	std::vector<LXtFVector2> solved_texcoords;
+
+	auto record = [&](const char* stage, const StageResultT& result)
+	{
+		results[bench.m_Name + "." + stage + ".corners_per_sec"] = result.m_CornersPerSec;
+		results[bench.m_Name + "." + stage + ".peak_bytes"] = (double)result.m_PeakBytes;
+	};
+
+	bool gathered = true;
+	record("gather", measure(repeat, corners,
+		[&]() { gather = UvGatherT(); },
+		[&]() {
+			for (unsigned i = 0; i < bench.m_Scene.size(); i++)
+			{
+				SyntheticMeshAccessT access(bench.m_Scene[i]);
+				gathered &= gatherLayer(access, i, gather);
+			}
+		}));
+
+	bool valid = true;
+	record("validate", measure(repeat, corners,
+		[]() {},
+		[&]() { valid = validateUvData(gather.m_VertArray, gather.m_FaceArray).empty(); }));
+
+	// The generated meshes should always be valid, anything else is a bug in the generators
+	if (!gathered || !valid)
+	{
+		std::printf("%s: generated mesh failed to gather or validate\n", bench.m_Name.c_str());
+		std::exit(2);
+	}
+
+	UvInstancesT instances;
+	record("instance", measure(repeat, corners,
+		[&]() { instances = UvInstancesT(); },
+		[&]() { instanceIslands(gather, false, instances); }));
+
+	// Includes dropping the vertices of the replaced islands, as uvp.pack does
+	UvProxiesT proxies;
+	UvCompactT compacted;
+	record("proxy", measure(repeat, corners,
+		[&]() { proxies = UvProxiesT(); },
+		[&]() {
+			proxyStaticIslands(gather.m_VertArray, gather.m_FaceArray, proxies);
+			compactVerts(proxies.m_FaceArray, gather.m_VertArray, compacted);
+		}));
+
+	// Fake a packing solution, every island is moved, scaled and rotated.
+	RandomT random(42);
+	for (const SyntheticLayerT& layer : bench.m_Scene)
+	{
+		for (const std::vector<unsigned>& island : layer.m_Islands)
+		{
+			std::vector<int> faces;
+			for (unsigned polygon : island)
+				faces.push_back(gather.m_PolygonMap.at(layer.polygonID(polygon)));
+
+			UvpIslandPackSolutionT solution = {};
+			solution.m_IslandIdx = (int)islands.size();
+			solution.m_Scale = 1.0f + random.next();
+			solution.m_PreScale = 1.0f;
+			solution.m_Angle = random.next() * 3.14159f;
+			solution.m_Offset[0] = random.next();
+			solution.m_Offset[1] = random.next();
+			solution.m_Pivot[0] = random.next();
+			solution.m_Pivot[1] = random.next();
+
+			islands.push_back(std::move(faces));
+			solutions.push_back(solution);
+		}
+	}
+
+	record("solve", measure(repeat, corners,
+		[]() {},
+		[&]() { solveTexcoords(islands, solutions, gather.m_FaceArray, gather.m_VertArray, solved_texcoords); }));
+
+	record("write", measure(repeat, corners,
+		[]() {},
+		[&]() {
+			for (SyntheticLayerT& layer : bench.m_Scene)
+			{
+				SyntheticMeshAccessT access(layer);
+				writeLayer(access, gather, solved_texcoords);
+			}
+		}));
+
+	std::printf("%-10s %10zu corners\n", bench.m_Name.c_str(), corners);
+	for (const char* stage : { "gather", "validate", "instance", "proxy", "solve", "write" })
+	{
+		std::printf("  %-8s %14.0f corners/sec %12.1f MB peak\n", stage,
+			results[bench.m_Name + "." + stage + ".corners_per_sec"],
+			results[bench.m_Name + "." + stage + ".peak_bytes"] / (1024.0 * 1024.0));
+	}
+}
+
+// Read a flat json object of "key": number pairs, keys with null values are
+// left out.
+bool readResults(const char* path, std::map<std::string, double>& values)
+{
+	std::ifstream file(path);
+	if (!file)
+		return false;
+
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	const std::string text = buffer.str();
+
+	size_t pos = 0;
+	while ((pos = text.find('"', pos)) != std::string::npos)
+	{
+		size_t end = text.find('"', pos + 1);
+		if (end == std::string::npos)
+			break;
+
+		std::string key = text.substr(pos + 1, end - pos - 1);
+		size_t colon = text.find(':', end);
+		if (colon == std::string::npos)
+			break;
+
+		const char* value = text.c_str() + colon + 1;
+		char* parsed = nullptr;
+		double number = std::strtod(value, &parsed);
+		if (parsed != value)
+			values[key] = number;
+
+		pos = text.find_first_of(",}", colon);
+		if (pos == std::string::npos)
+			break;
+	}
+	return true;
+}
+
+bool writeResults(const char* path, const std::map<std::string, double>& values)
+{
+	std::ofstream file(path);
+	if (!file)
+		return false;
+
+	// Default tolerance, so the output can be used as a baseline as is
+	file << "{\n  \"tolerance\": 0.15,\n";
+	size_t i = 0;
+	for (const auto& value : values)
+	{
+		char number[64];
+		std::snprintf(number, sizeof(number), "%.0f", value.second);
+		file << "  \"" << value.first << "\": " << number << (++i < values.size() ? ",\n" : "\n");
+	}
+	file << "}\n";
+	return true;
+}
+
+// Compare against the baseline, throughput may drop and memory may grow by
+// the baseline "tolerance" (fraction, 0.15 if not set) before failing.
+bool checkBaseline(const std::map<std::string, double>& results, const std::map<std::string, double>& baseline)
+{
+	auto found = baseline.find("tolerance");
+	const double tolerance = found != baseline.end() ? found->second : 0.15;
+
+	bool passed = true;
+	size_t compared = 0;
+	for (const auto& entry : baseline)
+	{
+		auto result = results.find(entry.first);
+		if (result == results.end())
+			continue;
+		compared++;
+
+		bool throughput = entry.first.find(".corners_per_sec") != std::string::npos;
+		bool regressed = throughput
+			? result->second < entry.second * (1.0 - tolerance)
+			: result->second > entry.second * (1.0 + tolerance);
+
+		if (regressed)
+		{
+			std::printf("REGRESSION %s: %.0f, baseline %.0f\n", entry.first.c_str(), result->second, entry.second);
+			passed = false;
+		}
+	}
+
+	if (compared == 0)
+	{
+		std::printf("baseline has no recorded values, nothing was checked\n");
+		return false;
+	}
+
+	std::printf("compared %zu of %zu values against the baseline\n", compared, results.size());
+	return passed;
+}
+
+int main(int argc, char** argv)
+{
+	float scale = 1.0f;
+	unsigned repeat = 3;
+	const char* outPath = nullptr;
+	const char* baselinePath = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!std::strcmp(argv[i], "--scale") && i + 1 < argc)
+			scale = (float)std::atof(argv[++i]);
+		else if (!std::strcmp(argv[i], "--repeat") && i + 1 < argc)
+			repeat = std::max(1, std::atoi(argv[++i]));
+		else if (!std::strcmp(argv[i], "--out") && i + 1 < argc)
+			outPath = argv[++i];
+		else if (!std::strcmp(argv[i], "--baseline") && i + 1 < argc)
+			baselinePath = argv[++i];
+		else
+		{
+			std::printf("usage: %s [--scale <float>] [--repeat <n>] [--out <file>] [--baseline <file>]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	std::map<std::string, double> results;
+	{
+		std::vector<BenchCaseT> corpus = buildCorpus(scale);
+		for (BenchCaseT& bench : corpus)
+			runCase(bench, repeat, results);
+	}
+
+	if (outPath && !writeResults(outPath, results))
+	{
+		std::printf("failed to write %s\n", outPath);
+		return 2;
+	}
+
+	if (baselinePath)
+	{
+		std::map<std::string, double> baseline;
+		if (!readResults(baselinePath, baseline))
+		{
+			std::printf("failed to read %s\n", baselinePath);
+			return 2;
+		}
+		if (!checkBaseline(results, baseline))
+			return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,274 @@
+#pragma once
+
+// Capture files hold the exact input of a UVP pack operation, so a slow or
+// failing pack from a production scene can be replayed outside of Modo with
+// tools/uvpackit_replay.cpp.
+//
+// Layout, native (little) endian and every section 8 byte aligned so the file
+// can be memory mapped and read in place:
+//
+//   UvpCaptureHeaderT
+//   UvpCaptureVertT[m_VertCount]
+//   UvpCaptureFaceT[m_FaceCount]	with the group of each face for grouped packs
+//   int32_t[m_IndexCount]		vertex indices of all faces, back to back
+
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// UV Packmaster
+#include <uvpCore.hpp>
+
+using namespace uvpcore;
+
+static const char UVP_CAPTURE_MAGIC[8] = { 'U', 'V', 'P', 'C', 'A', 'P', 'T', '\0' };
+static const uint32_t UVP_CAPTURE_VERSION = 4;
+
+// Time spent in each stage of the captured run, in milliseconds. Stages that
+// didn't finish, because they failed or haven't run yet, are negative. Building
+// instances and proxies counts towards the pack.
+struct UvpCaptureTimingT
+{
+	double m_GatherMs = -1.0;
+	double m_ValidateMs = -1.0;
+	double m_PackMs = -1.0;
+	double m_WriteMs = -1.0;
+};
+
+// How uvp.pack split up the captured pack, so it can be replayed the same way.
+// At most one of grouping, clustering and sweeping is used.
+struct UvpCaptureModeT
+{
+	int32_t m_GroupMode = 0;	// group argument of uvp.pack, 0 if not grouped
+	int32_t m_GroupCount = 0;
+	int32_t m_SweepCount = 0;	// variants in a parameter sweep, 0 if packed once
+	int32_t m_SweepMetric = 0;	// SweepMetricT ranking the variants
+	int32_t m_ClusterCount = 0;	// clusters asked for in a hierarchical pack, 0 if not hierarchical
+};
+
+struct UvpCaptureHeaderT
+{
+	char m_Magic[8];
+	uint32_t m_Version;
+	uint32_t m_HeaderSize;
+
+	// Pack parameters, see basic_Execute for what each of them does
+	int32_t m_FixedScale;
+	int32_t m_RotationStep;
+	int32_t m_PrerotDisable;
+	int32_t m_NormalizeIslands;
+	int32_t m_PackToOthers;
+	int32_t m_ProcessUnselected;
+	int32_t m_RenderInvalidIslands;
+	int32_t m_PixelMarginTextureSize;
+	float m_Margin;
+	float m_PixelMargin;
+	float m_PixelPadding;
+
+	UvpCaptureModeT m_Mode;
+
+	UvpCaptureTimingT m_Timing;
+
+	uint64_t m_VertCount;
+	uint64_t m_FaceCount;
+	uint64_t m_IndexCount;
+
+	// Byte offsets of the sections from the start of the file,
+	uint64_t m_VertOffset;
+	uint64_t m_FaceOffset;
+	uint64_t m_IndexOffset;
+};
+
+struct UvpCaptureVertT
+{
+	float m_UvCoords[2];
+	float m_Vert3dCoords[3];
+	int32_t m_ControlId;
+};
+
+struct UvpCaptureFaceT
+{
+	uint32_t m_FirstIndex;
+	uint32_t m_IndexCount;
+	int32_t m_FaceId;
+	int32_t m_InputFlags;
+	int32_t m_Group;
+};
+
+inline uint64_t alignCapture(uint64_t offset)
+{
+	return (offset + 7) & ~(uint64_t)7;
+}
+
+// Write the uv data and parameters of uvpInput to path, with the pack mode and,
+// for grouped packs, the group of every face. Returns false if the file could
+// not be written.
+inline bool writeCapture(const std::string& path, const UvpOperationInputT& uvpInput, const UvpCaptureModeT& mode, const std::vector<int>& faceGroup, const UvpCaptureTimingT& timing)
+{
+	const UvDataT& uvData = uvpInput.m_UvData;
+
+	UvpCaptureHeaderT header = {};
+	std::memcpy(header.m_Magic, UVP_CAPTURE_MAGIC, sizeof(header.m_Magic));
+	header.m_Version = UVP_CAPTURE_VERSION;
+	header.m_HeaderSize = sizeof(UvpCaptureHeaderT);
+
+	header.m_FixedScale = uvpInput.m_FixedScale;
+	header.m_RotationStep = uvpInput.m_RotationStep;
+	header.m_PrerotDisable = uvpInput.m_PrerotDisable;
+	header.m_NormalizeIslands = uvpInput.m_NormalizeIslands;
+	header.m_PackToOthers = uvpInput.m_PackToOthers;
+	header.m_ProcessUnselected = uvpInput.m_ProcessUnselected;
+	header.m_RenderInvalidIslands = uvpInput.m_RenderInvalidIslands;
+	header.m_PixelMarginTextureSize = uvpInput.m_PixelMarginTextureSize;
+	header.m_Margin = uvpInput.m_Margin;
+	header.m_PixelMargin = uvpInput.m_PixelMargin;
+	header.m_PixelPadding = uvpInput.m_PixelPadding;
+	header.m_Mode = mode;
+	header.m_Timing = timing;
+
+	std::vector<UvpCaptureFaceT> faces(uvData.m_FaceCount);
+	std::vector<int32_t> indices;
+	for (int i = 0; i < uvData.m_FaceCount; i++)
+	{
+		const UvFaceT& face = uvData.m_pFaceArray[i];
+		faces[i].m_FirstIndex = (uint32_t)indices.size();
+		faces[i].m_FaceId = face.m_FaceId;
+		faces[i].m_InputFlags = face.m_InputFlags;
+		faces[i].m_Group = faceGroup.empty() ? 0 : faceGroup[i];
+		for (int vertIdx : face.m_Verts)
+			indices.push_back(vertIdx);
+		faces[i].m_IndexCount = (uint32_t)indices.size() - faces[i].m_FirstIndex;
+	}
+
+	std::vector<UvpCaptureVertT> verts(uvData.m_VertCount);
+	for (int i = 0; i < uvData.m_VertCount; i++)
+	{
+		const UvVertT& vert = uvData.m_pVertArray[i];
+		std::memcpy(verts[i].m_UvCoords, vert.m_UvCoords, sizeof(verts[i].m_UvCoords));
+		std::memcpy(verts[i].m_Vert3dCoords, vert.m_Vert3dCoords, sizeof(verts[i].m_Vert3dCoords));
+		verts[i].m_ControlId = vert.m_ControlId;
+	}
+
+	header.m_VertCount = verts.size();
+	header.m_FaceCount = faces.size();
+	header.m_IndexCount = indices.size();
+	header.m_VertOffset = alignCapture(sizeof(UvpCaptureHeaderT));
+	header.m_FaceOffset = alignCapture(header.m_VertOffset + verts.size() * sizeof(UvpCaptureVertT));
+	header.m_IndexOffset = alignCapture(header.m_FaceOffset + faces.size() * sizeof(UvpCaptureFaceT));
+
+	FILE* file = std::fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+
+	// Write a section at its offset, padding with zeros up to it
+	uint64_t written = 0;
+	auto write = [&](const void* data, uint64_t offset, uint64_t size)
+	{
+		static const char padding[8] = {};
+		bool ok = std::fwrite(padding, 1, (size_t)(offset - written), file) == offset - written;
+		ok &= size == 0 || std::fwrite(data, 1, (size_t)size, file) == size;
+		written = offset + size;
+		return ok;
+	};
+
+	bool ok = write(&header, 0, sizeof(header));
+	ok &= write(verts.data(), header.m_VertOffset, verts.size() * sizeof(UvpCaptureVertT));
+	ok &= write(faces.data(), header.m_FaceOffset, faces.size() * sizeof(UvpCaptureFaceT));
+	ok &= write(indices.data(), header.m_IndexOffset, indices.size() * sizeof(int32_t));
+
+	return std::fclose(file) == 0 && ok;
+}
+
+// Rewrite the timing summary of an existing capture, used once the stages that
+// run after writing the capture are done.
+inline bool updateCaptureTiming(const std::string& path, const UvpCaptureTimingT& timing)
+{
+	FILE* file = std::fopen(path.c_str(), "r+b");
+	if (!file)
+		return false;
+
+	bool ok = std::fseek(file, offsetof(UvpCaptureHeaderT, m_Timing), SEEK_SET) == 0 &&
+		std::fwrite(&timing, sizeof(timing), 1, file) == 1;
+
+	return std::fclose(file) == 0 && ok;
+}
+
+// Rebuild the operation input from a capture file held in memory, usually
+// mapped. UVP needs its own vertex and face types, so the arrays are converted
+// into verts and faces, which must outlive uvpInput. faceGroup receives the
+// group of every face for grouped packs and is left empty otherwise. Returns an
+// error message, or nullptr on success.
+inline const char* readCapture(const char* data, uint64_t size, UvpOperationInputT& uvpInput, UvpCaptureModeT& mode, std::vector<UvVertT>& verts, std::vector<UvFaceT>& faces, std::vector<int>& faceGroup)
+{
+	if (size < sizeof(UvpCaptureHeaderT) || std::memcmp(data, UVP_CAPTURE_MAGIC, sizeof(UVP_CAPTURE_MAGIC)) != 0)
+		return "not a capture file";
+
+	const UvpCaptureHeaderT& header = *reinterpret_cast<const UvpCaptureHeaderT*>(data);
+	if (header.m_Version != UVP_CAPTURE_VERSION || header.m_HeaderSize != sizeof(UvpCaptureHeaderT))
+		return "unsupported capture version";
+
+	if (header.m_VertOffset + header.m_VertCount * sizeof(UvpCaptureVertT) > size ||
+		header.m_FaceOffset + header.m_FaceCount * sizeof(UvpCaptureFaceT) > size ||
+		header.m_IndexOffset + header.m_IndexCount * sizeof(int32_t) > size)
+		return "capture file is truncated";
+
+	const UvpCaptureVertT* capture_verts = reinterpret_cast<const UvpCaptureVertT*>(data + header.m_VertOffset);
+	const UvpCaptureFaceT* capture_faces = reinterpret_cast<const UvpCaptureFaceT*>(data + header.m_FaceOffset);
+	const int32_t* indices = reinterpret_cast<const int32_t*>(data + header.m_IndexOffset);
+
+	uvpInput.m_pDeviceId = "cpu";
+	uvpInput.m_Opcode = UVP_OPCODE::PACK;
+	uvpInput.m_FixedScale = header.m_FixedScale != 0;
+	uvpInput.m_RotationStep = header.m_RotationStep;
+	uvpInput.m_PrerotDisable = header.m_PrerotDisable != 0;
+	uvpInput.m_NormalizeIslands = header.m_NormalizeIslands != 0;
+	uvpInput.m_PackToOthers = header.m_PackToOthers != 0;
+	uvpInput.m_ProcessUnselected = header.m_ProcessUnselected != 0;
+	uvpInput.m_RenderInvalidIslands = header.m_RenderInvalidIslands != 0;
+	uvpInput.m_PixelMarginTextureSize = header.m_PixelMarginTextureSize;
+	uvpInput.m_Margin = header.m_Margin;
+	uvpInput.m_PixelMargin = header.m_PixelMargin;
+	uvpInput.m_PixelPadding = header.m_PixelPadding;
+	mode = header.m_Mode;
+
+	verts.resize((size_t)header.m_VertCount);
+	for (size_t i = 0; i < verts.size(); i++)
+	{
+		std::memcpy(verts[i].m_UvCoords, capture_verts[i].m_UvCoords, sizeof(verts[i].m_UvCoords));
+		std::memcpy(verts[i].m_Vert3dCoords, capture_verts[i].m_Vert3dCoords, sizeof(verts[i].m_Vert3dCoords));
+		verts[i].m_ControlId = capture_verts[i].m_ControlId;
+	}
+
+	faces.clear();
+	faces.reserve((size_t)header.m_FaceCount);
+	faceGroup.clear();
+	for (uint64_t i = 0; i < header.m_FaceCount; i++)
+	{
+		const UvpCaptureFaceT& capture_face = capture_faces[i];
+		if ((uint64_t)capture_face.m_FirstIndex + capture_face.m_IndexCount > header.m_IndexCount)
+			return "face indices out of range";
+
+		faces.emplace_back(capture_face.m_FaceId);
+		UvFaceT& face = faces.back();
+		face.m_InputFlags = capture_face.m_InputFlags;
+		if (mode.m_GroupMode != 0)
+		{
+			if (capture_face.m_Group < 0 || capture_face.m_Group >= mode.m_GroupCount)
+				return "face group out of range";
+			faceGroup.push_back(capture_face.m_Group);
+		}
+		face.m_Verts.reserve((SizeT)capture_face.m_IndexCount);
+		for (uint32_t j = 0; j < capture_face.m_IndexCount; j++)
+			face.m_Verts.pushBack(indices[capture_face.m_FirstIndex + j]);
+	}
+
+	uvpInput.m_UvData.m_VertCount = (int)verts.size();
+	uvpInput.m_UvData.m_pVertArray = verts.data();
+	uvpInput.m_UvData.m_FaceCount = (int)faces.size();
+	uvpInput.m_UvData.m_pFaceArray = faces.data();
+
+	return nullptr;
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <string>
+#include <array>
+#include <list>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+
+// UV Packmaster
+#include <uvpCore.hpp>
+
+using namespace uvpcore;
+
+// UV Packmaster Related classes, slightly tweaked from their FBX example,
+// url: https://uvpackmaster.com/sdkdoc/90-sample-application/
+
+typedef std::array<UvpMessageT*, static_cast<int>(UvpMessageT::MESSAGE_CODE::VALUE_COUNT)> UvpMessageArrayT;
+void opExecutorMessageHandler(void* m_pMessageHandlerData, UvpMessageT* pMsg);
+
+// Wrapper class simplifying execution of UVP operations.
+class UvpOpExecutorT
+{
+private:
+	friend void opExecutorMessageHandler(void* m_pMessageHandlerData, UvpMessageT* pMsg);
+
+	std::list<UvpMessageT*> m_ReceivedMessages;
+	UvpMessageArrayT m_LastMessagePerCode;
+
+	bool m_DebugMode;
+
+	// The operation is created on the worker thread running execute, while
+	// cancel is called from the main thread, so both go through the mutex.
+	// m_Cancelled covers a cancel that comes before the operation exists.
+	std::mutex m_OperationMutex;
+	UvpOperationT* operation = nullptr;
+	bool m_Cancelled = false;
+
+	void destroyMessages()
+	{
+		// The application becomes the owner of UVP messages after receiving it,
+		// so we have to make sure they are eventually deallocated by calling
+		// the destory method on them (do not use the delete operator).
+		for (UvpMessageT* pMsg : m_ReceivedMessages)
+		{
+			pMsg->destroy();
+		}
+		m_ReceivedMessages.clear();
+	}
+
+	void reset()
+	{
+		destroyMessages();
+		m_LastMessagePerCode = { nullptr };
+	}
+
+	// This method is called every time the packer sends a message to the application.
+	// We need to handle the message properly.
+	// https://uvpackmaster.com/sdkdoc/20-communication-with-the-packer/
+	void handleMessage(UvpMessageT* pMsg)
+	{
+		if (pMsg->m_Code == UvpMessageT::MESSAGE_CODE::PROGRESS_REPORT)
+		{
+			UvpProgressReportMessageT* pReportProgressMsg = static_cast<UvpProgressReportMessageT*>(pMsg);
+
+			for (int i = 0; i < pReportProgressMsg->m_ProgressSize; i++)
+			{
+				// m_ProgressArray, An array which stores actual progress information. 
+				// It contains m_ProgressSize integers ranging from 0 to 100 (percent).
+				// Get the progress % from the message,
+				unsigned progress = pReportProgressMsg->m_ProgressArray[i];
+
+				// Get a local variable for the atomic uints, to shield
+				// against us overwriting the progress with a lower value
+				// causing the monitor to loop forever.
+				unsigned current = 0;
+
+				// Set the public facing progress so main thread can 
+				// update the progress bar.
+				switch (pReportProgressMsg->m_PackingPhase)
+				{
+				case uvpcore::UVP_PACKING_PHASE_CODE::TOPOLOGY_ANALYSIS:
+					current = topology_progress;
+					topology_progress = (progress > current ? progress : current);
+					break;
+				// PACKING and PIXEL_MARGIN_ADJUSTMENT will both push our progress bar
+				// seeing how PACKING will run when using `margin` and PIXEL_MARGIN_ADJUSTMENT
+				// will enter if users specify the pixels for margin/padding
+				case uvpcore::UVP_PACKING_PHASE_CODE::PACKING:
+				case uvpcore::UVP_PACKING_PHASE_CODE::PIXEL_MARGIN_ADJUSTMENT:
+					current = packing_progress;
+					packing_progress = (progress > current ? progress : current);
+					break;
+				default:
+					break;
+				}
+			}
+		}
+		m_LastMessagePerCode[static_cast<int>(pMsg->m_Code)] = pMsg;
+		m_ReceivedMessages.push_back(pMsg);
+	}
+
+public:
+	// Thread safe uints to track progress of different phases,
+	std::atomic_uint topology_progress = 0;
+	std::atomic_uint packing_progress = 0;
+
+	UvpOpExecutorT(bool debugMode) :
+		m_DebugMode(debugMode)
+	{}
+
+	~UvpOpExecutorT()
+	{
+		destroyMessages();
+		if (operation != nullptr)
+			delete operation;
+	}
+
+	UVP_ERRORCODE execute(UvpOperationInputT& uvpInput)
+	{
+		reset();
+
+		uvpInput.m_pMessageHandler = opExecutorMessageHandler;
+		uvpInput.m_pMessageHandlerData = this;
+
+		if (m_DebugMode)
+		{
+			// Check whether the application configurated the operation input properly.
+			// WARNING: this operation is time consuming (in particular it iterates over all UV data),
+			// that is why it should only be executed when debugging the application. It should
+			// never be used in production.
+			// https://uvpackmaster.com/sdkdoc/40-uv-map-format/
+			const char* pValidationResult = uvpInput.validate();
+
+			// This runtime error will be caught inside the ccommand::execute when getting result from future,
+			if (pValidationResult)
+			{
+				throw std::runtime_error("UVP Operation input validation failed: " + std::string(pValidationResult));
+			}
+		}
+
+		UvpOperationT* pOperation = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(m_OperationMutex);
+			if (m_Cancelled)
+			{
+				topology_progress = 100;
+				packing_progress = 100;
+				return UVP_ERRORCODE::CANCELLED;
+			}
+
+			delete operation;
+			operation = pOperation = new UvpOperationT(uvpInput);
+		}
+
+		// Start actual execution of the operation. This method wont return
+		// until the operation is done, so it must be called from a different
+		// thread, if you dont want your application to be blocked.
+		// https://uvpackmaster.com/sdkdoc/10-classes/10-uvpoperationt/#ID_entry
+		UVP_ERRORCODE retCode = pOperation->entry();
+
+		// Being done, to ensure we don't get stuck with the monitor let's set
+		// all progress to 100,
+		topology_progress = 100;
+		packing_progress = 100;
+
+		return retCode;
+	}
+
+	UvpMessageT* getLastMessage(UvpMessageT::MESSAGE_CODE code)
+	{
+		return m_LastMessagePerCode[static_cast<int>(code)];
+	}
+
+	void cancel()
+	{
+		std::lock_guard<std::mutex> lock(m_OperationMutex);
+		m_Cancelled = true;
+		if (operation == nullptr)
+			return;
+
+		// Send a signal to the packer that it should stop further execution.
+		// This method only sends a signal and returns immediately - in 
+		// particular returning from this method doesnt indicate that the 
+		// packer already stopped the operation. After executing the cancel 
+		// method you can expect that the call to the entry method will return
+		// in a very short time (possibly with the return code set to CANCELLED).
+		operation->cancel();
+	}
+};
+
+inline void opExecutorMessageHandler(void* m_pMessageHandlerData, UvpMessageT* pMsg)
+{
+	// This handler is called every time the packer sends a message to the application.
+	// Simply pass the message to the underlaying executor object.
+	reinterpret_cast<UvpOpExecutorT*>(m_pMessageHandlerData)->handleMessage(pMsg);
+}
@@ -0,0 +1,1473 @@
+#pragma once
+
+// Stages of the uvp.pack command that don't need a running Modo session,
+// gathering uv data from a mesh, validating it, applying a packing solution and
+// writing the solved uvs back. The mesh is accessed through a template
+// parameter so the same code runs against the Modo accessors in uvpackit.cpp
+// and the synthetic meshes used by the benchmarks.
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include <thread>
+#include <future>
+
+// UV Packmaster
+#include <uvpCore.hpp>
+
+// Modo Math utilities and mesh types,
+#include <lxvmath.h>
+#include <lxu_matrix.hpp>
+#include <lxu_vector.hpp>
+#include <lxmesh.h>
+
+// Pack settings shared with the C entry point,
+#include "uvpackit_api.h"
+
+using namespace uvpcore;
+
+// Defaults of the uvp.pack arguments,
+inline void defaultPackSettings(UvpackitSettingsT& settings)
+{
+	settings.stretch = 1;
+	settings.orient = 1;
+	settings.margin = 0.003f;
+	settings.pixelMargin = 0.0f;
+	settings.pixelPadding = 0.0f;
+	settings.pixelMarginTextureSize = 2048;
+	settings.normalizeIslands = 0;
+}
+
+// Set up uvpInput for packing with settings, everything but the uv data.
+// documentation: https://uvpackmaster.com/sdkdoc/70-packer-operations/20-pack/
+inline void applyPackSettings(const UvpackitSettingsT& settings, UvpOperationInputT& uvpInput)
+{
+	uvpInput.m_pDeviceId = "cpu";
+	uvpInput.m_Opcode = UVP_OPCODE::PACK;
+
+	// When stretch is set to true, the packer will scale islands during packing.
+	// If UV islands cant fit into the packing box, the NO_SPACE code 
+	// will be returned by the operation.
+	uvpInput.m_FixedScale = !settings.stretch;
+
+	// If orient is false, do not allow packer to rotate the islands.
+	if (!settings.orient)
+	{
+		uvpInput.m_RotationStep = 0;
+		uvpInput.m_PrerotDisable = true;
+	}
+
+	// Determines the distance between islands after packing. The margin
+	// distance is scaled by a certain factor after packing is done, that is
+	// why the margin specified by this parameter is not exactly preserved.
+	// If user set the pixel margin, margin will be ignored.
+	uvpInput.m_Margin = settings.margin;
+
+	// Determines the distance between UV islands in pixels of the texture. 
+	// A margin defined using this parameter is exact (in contrast to the 
+	// m_Margin member). This parameter is only used if its value is greater
+	// than 0 (in such a case the m_Margin option is ignored and this parameter
+	// is used to determine distance between UV islands).
+	uvpInput.m_PixelMargin = settings.pixelMargin;
+
+	// Determines the distance in pixels between UV islands and the packing
+	// box border. This option is only used if m_PixelMargin is enabled. 
+	// Setting m_PixelPadding to 0 means the feature will be ignored and pixel
+	// padding will be equal to the half of m_PixelMargin.
+	uvpInput.m_PixelPadding = settings.pixelPadding;
+
+	// Specifies the size of the texture the packed UV map will be used with. 
+	// It allows proper application of the m_PixelMargin/ m_PixelPadding 
+	// values during the packing process.
+	uvpInput.m_PixelMarginTextureSize = settings.pixelMarginTextureSize;
+
+	// If set to true, the packer will automatically scale UV islands 
+	// before packing so that the average texel density is the same 
+	// for every island.
+	uvpInput.m_NormalizeIslands = settings.normalizeIslands != 0;
+}
+
+// In place translation for matrix m
+inline void translate_in_place(CLxMatrix4& m, float x, float y, float z)
+{
+	LXtVector4 t = { x, y, z, 0.0 };
+
+	// For each row in matrix, increment the translate xyzw with row dot t
+	for (int i = 0; i < 3; i++) {
+		LXtVector4 r = { m[i][0], m[i][1], m[i][2], m[i][3] };
+		m.set(i, 3, m[i][3] + LXx_V4DOT(t, r));
+	}
+}
+
+// anisotropic scaling of matrix m
+inline void scale_aniso(CLxMatrix4& m, float x, float y, float z)
+{
+	m.set(
+		m[0][0] * x, m[0][1] * y, m[0][2] * z, m[0][3],
+		m[1][0] * x, m[1][1] * y, m[1][2] * z, m[1][3],
+		m[2][0] * x, m[2][1] * y, m[2][2] * z, m[2][3],
+		m[3][0] * x, m[3][1] * y, m[3][2] * z, m[3][3]
+	);
+}
+
+// get result of vector * matrix multiplication
+inline void mat4x4_mul_vec4(LXtVector4& result, const LXtMatrix4 m, const LXtVector4 v)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		result[i] = LXx_V4DOT(m[i], v);
+	}
+}
+
+inline void islandSolutionToMatrix(const UvpIslandPackSolutionT& islandSolution, CLxMatrix4& mat)
+{	// Set matrix used to transform UVs of the given island in order to apply
+	// a packing result	
+	mat.setToIdentity();
+
+	// Move the uv island and apply scale in xy, 
+	translate_in_place(mat, islandSolution.m_PostScaleOffset[0], islandSolution.m_PostScaleOffset[1], 0.0);
+	scale_aniso(mat, 1.0 / islandSolution.m_Scale, 1.0 / islandSolution.m_Scale, 1.0);
+
+	// Move the islands again, likely to compensate for scaling,
+	translate_in_place(mat, islandSolution.m_Offset[0], islandSolution.m_Offset[1], 0.0);
+
+	// Move the islands to prepare for rotation,
+	translate_in_place(mat, islandSolution.m_Pivot[0], islandSolution.m_Pivot[1], 0.0);
+
+	// Apply the rotation
+	CLxVector z = { 0, 0, islandSolution.m_Angle };
+	mat = mat * CLxMatrix4(z, LXi_ROTORD_XYZ);
+
+	// Move the islands back after rotation,
+	translate_in_place(mat, -islandSolution.m_Pivot[0], -islandSolution.m_Pivot[1], 0.0);
+
+	scale_aniso(mat, islandSolution.m_PreScale, islandSolution.m_PreScale, 1.0);
+}
+
+// Faces rejected by validateUvData, grouped by the check they failed. Indices
+// are into the face array that was validated.
+struct UvDataIssuesT
+{
+	std::vector<int> m_BadIndex;		// vertex index outside of the vert array
+	std::vector<int> m_Degenerate;		// less than 3 corners or zero area in uv space
+	std::vector<int> m_NonFinite;		// NaN or inf in uv or 3d coordinates
+	std::vector<int> m_DuplicateCorner;	// same uv vertex used twice in the face
+
+	bool empty() const
+	{
+		return m_BadIndex.empty() && m_Degenerate.empty() && m_NonFinite.empty() && m_DuplicateCorner.empty();
+	}
+
+	void append(const UvDataIssuesT& other)
+	{
+		m_BadIndex.insert(m_BadIndex.end(), other.m_BadIndex.begin(), other.m_BadIndex.end());
+		m_Degenerate.insert(m_Degenerate.end(), other.m_Degenerate.begin(), other.m_Degenerate.end());
+		m_NonFinite.insert(m_NonFinite.end(), other.m_NonFinite.begin(), other.m_NonFinite.end());
+		m_DuplicateCorner.insert(m_DuplicateCorner.end(), other.m_DuplicateCorner.begin(), other.m_DuplicateCorner.end());
+	}
+};
+
+// Check a range of faces, each face is only visited once and the corners are
+// tested in the same loop, so this stays linear in the number of corners.
+inline void validateUvFaceRange(const UvVertT* verts, int vertCount, const UvFaceT* faces, int begin, int end, UvDataIssuesT& issues)
+{
+	// Corners of the current face, reused between faces to avoid allocating,
+	std::vector<int> corners;
+
+	for (int faceIdx = begin; faceIdx < end; faceIdx++)
+	{
+		const UvFaceT& face = faces[faceIdx];
+
+		corners.clear();
+		bool badIndex = false;
+		bool nonFinite = false;
+		for (int vertIdx : face.m_Verts)
+		{
+			if (vertIdx < 0 || vertIdx >= vertCount)
+			{
+				badIndex = true;
+				continue;
+			}
+
+			const UvVertT& vert = verts[vertIdx];
+			if (!std::isfinite(vert.m_UvCoords[0]) || !std::isfinite(vert.m_UvCoords[1]) ||
+				!std::isfinite(vert.m_Vert3dCoords[0]) || !std::isfinite(vert.m_Vert3dCoords[1]) || !std::isfinite(vert.m_Vert3dCoords[2]))
+				nonFinite = true;
+
+			corners.push_back(vertIdx);
+		}
+
+		if (badIndex)
+		{
+			issues.m_BadIndex.push_back(faceIdx);
+			continue;
+		}
+		if (nonFinite)
+		{
+			issues.m_NonFinite.push_back(faceIdx);
+			continue;
+		}
+
+		// Faces rarely have more than a handful of corners, so a quadratic scan
+		// is cheaper than sorting or hashing here.
+		bool duplicate = false;
+		for (size_t i = 0; i < corners.size() && !duplicate; i++)
+			for (size_t j = i + 1; j < corners.size(); j++)
+				if (corners[i] == corners[j])
+				{
+					duplicate = true;
+					break;
+				}
+
+		if (duplicate)
+		{
+			issues.m_DuplicateCorner.push_back(faceIdx);
+			continue;
+		}
+
+		// Twice the signed area of the face in uv space (shoelace formula),
+		double area = 0.0;
+		for (size_t i = 0; i < corners.size(); i++)
+		{
+			const UvVertT& a = verts[corners[i]];
+			const UvVertT& b = verts[corners[(i + 1) % corners.size()]];
+			area += (double)a.m_UvCoords[0] * b.m_UvCoords[1] - (double)b.m_UvCoords[0] * a.m_UvCoords[1];
+		}
+
+		if (corners.size() < 3 || area == 0.0)
+			issues.m_Degenerate.push_back(faceIdx);
+	}
+}
+
+// Validate the uv data before handing it to UVP. Unlike UvpOperationInputT::validate
+// this is cheap enough to run in release builds, the faces are split into one
+// contiguous range per hardware thread.
+inline UvDataIssuesT validateUvData(const std::vector<UvVertT>& verts, const std::vector<UvFaceT>& faces)
+{
+	const int faceCount = (int)faces.size();
+
+	// Not worth spinning up threads for small meshes,
+	const int minFacesPerThread = 16384;
+	int threadCount = (int)std::max(1u, std::thread::hardware_concurrency());
+	threadCount = std::max(1, std::min(threadCount, faceCount / minFacesPerThread));
+
+	std::vector<UvDataIssuesT> results(threadCount);
+	std::vector<std::future<void>> futures;
+
+	const int chunk = (faceCount + threadCount - 1) / std::max(threadCount, 1);
+	for (int i = 1; i < threadCount; i++)
+	{
+		int begin = std::min(faceCount, i * chunk);
+		int end = std::min(faceCount, begin + chunk);
+		futures.push_back(std::async(std::launch::async, validateUvFaceRange,
+			verts.data(), (int)verts.size(), faces.data(), begin, end, std::ref(results[i])));
+	}
+
+	// Calling thread takes the first range,
+	validateUvFaceRange(verts.data(), (int)verts.size(), faces.data(), 0, std::min(faceCount, chunk), results[0]);
+
+	for (auto& future : futures)
+		future.get();
+
+	// Ranges are in order, so merging keeps the face indices sorted.
+	UvDataIssuesT issues;
+	for (const UvDataIssuesT& result : results)
+		issues.append(result);
+
+	return issues;
+}
+
+// Data gathered from the meshes, in the form UVP expects plus the lookups
+// needed to write the solution back.
+struct UvGatherT
+{
+	// Using a map only to check we don't add duplicate uv coords
+	std::unordered_map<UvVertT, int, UvVertHashT, UvVertEqualT> m_UvMap;
+
+	// Containers to transfer the data to the uv packer later.
+	std::vector<UvVertT> m_VertArray;
+	std::vector<UvFaceT> m_FaceArray;
+
+	// Lookup tables to match Modo's IDs with whatever we tell UVP
+	std::unordered_map<LXtPolygonID, int> m_PolygonMap;
+	std::unordered_map<int, LXtPointID> m_PointMap;
+
+	// Layer and polygon index for each uvp face, only used to tell users
+	// which polygons failed validation. The item name of each layer is kept
+	// by layer index, as the layer index alone means nothing to users.
+	std::vector<std::pair<unsigned, unsigned>> m_FaceOrigin;
+	std::vector<std::string> m_LayerNames;
+
+	// Set if any gathered polygon is unselected,
+	bool m_PackToOthers = false;
+
+	// Polygon tag type to group faces by, or 0 to not group. Each distinct tag
+	// value gets a group index, polygons without the tag share the "" group.
+	LXtID4 m_GroupTag = 0;
+	std::vector<int> m_FaceGroup;
+	std::vector<std::string> m_GroupNames;
+	std::unordered_map<std::string, int> m_GroupIndex;
+};
+
+// Polygons gatherLayer and writeLayer handle between calls to their progress
+// callback, small enough to keep a monitor responsive on dense meshes.
+static const unsigned UV_PROGRESS_CHUNK = 16384;
+
+// Progress callback that never aborts, for callers without a monitor. Progress
+// callbacks get the number of polygons done since the last call and return
+// true to abort.
+struct UvNoProgressT
+{
+	bool operator()(unsigned) const { return false; }
+};
+
+// Gather the uv faces of every visible polygon of a layer. MeshT wraps the mesh
+// accessors, see ModoMeshAccessT in uvpackit.cpp for the interface. Returns
+// false if a polygon vertex has no uv value. If progress asks to abort, the
+// layer is left partly gathered and true is returned, the caller is expected
+// to keep track of the abort itself.
+template <typename MeshT, typename ProgressT = UvNoProgressT>
+bool gatherLayer(MeshT& mesh, unsigned layerIndex, UvGatherT& gather, ProgressT&& progress = ProgressT())
+{
+	LXtFVector2 texcoords;
+	LXtFVector position;
+
+	// UVP expects face id's as integer, while Modo have a typedef that can be cast to unsigned
+	// and I don't want to bother with converting
+	int uvp_face_index = (int)gather.m_FaceArray.size();
+
+	// For each polygon, get uv values for uvp
+	unsigned polygon_count = mesh.polygonCount();
+	for (unsigned polygon_index = 0; polygon_index < polygon_count; polygon_index++)
+	{
+		if (polygon_index > 0 && polygon_index % UV_PROGRESS_CHUNK == 0 && progress(UV_PROGRESS_CHUNK))
+			return true;
+
+		// Change the currently active polygon and get it's ID
+		mesh.selectPolygon(polygon_index);
+		LXtPolygonID polygon_id = mesh.polygonID();
+
+		// Skip hidden polygons,
+		if (mesh.polygonHidden())
+			continue;
+
+		// Store the Polygon ID so we can access and set the 
+		gather.m_PolygonMap.insert(std::make_pair(polygon_id, uvp_face_index));
+
+		// Get the number of vertices for this polygon,
+		unsigned vertex_count = mesh.vertexCount();
+
+		// Create the UVP Face, the counter uvp_polygon_id will act as the ID that we have mapped to Modo's IDs
+		// https://uvpackmaster.com/sdkdoc/10-classes/50-uvfacet/
+		gather.m_FaceArray.emplace_back(uvp_face_index);
+		gather.m_FaceOrigin.emplace_back(layerIndex, polygon_index);
+		UvFaceT& face = gather.m_FaceArray.back();
+		if (mesh.polygonSelected()) {
+			face.m_InputFlags = static_cast<int>(uvpcore::UVP_FACE_INPUT_FLAGS::SELECTED);
+		} else {
+			gather.m_PackToOthers = true;
+			face.m_InputFlags = 0;
+		}
+		face.m_Verts.reserve((SizeT)vertex_count);
+
+		// Look up the group for the polygon, adding new groups as we find them
+		if (gather.m_GroupTag)
+		{
+			const char* tag = mesh.polygonTag(gather.m_GroupTag);
+			auto group = gather.m_GroupIndex.emplace(tag ? tag : "", (int)gather.m_GroupNames.size());
+			if (group.second)
+				gather.m_GroupNames.push_back(group.first->first);
+			gather.m_FaceGroup.push_back(group.first->second);
+		}
+
+		// For each face vertex, get the texcoord values
+		for (unsigned vertex_index = 0; vertex_index < vertex_count; vertex_index++)
+		{
+			LXtPointID point_id = mesh.vertexByIndex(vertex_index);
+
+			// Get the UV coordinates for polygon vertex
+			if (!mesh.evaluateUV(point_id, texcoords))
+				return false;
+
+			// And the positional data
+			mesh.position(point_id, position);
+
+			// Create vertex and copy values for uvp, comments below are from docs
+			// https://uvpackmaster.com/sdkdoc/10-classes/40-uvvertt/
+			UvVertT uvp_vertex;
+
+			// UV coordinates of the given UV vertex. This field must always be 
+			// initialized by the application.
+			uvp_vertex.m_UvCoords[0] = texcoords[0];
+			uvp_vertex.m_UvCoords[1] = texcoords[1];
+
+			// An integer value which is internally ignored by the packer, so the 
+			// application may initialize it according to its needs. In particular 
+			// this field might be used when building m_pVertArray in order to 
+			// distinguish two UV vertices which have the same UV coordinates, but 
+			// correspond to two different 3D vertices. Check the Sample application
+			// code for a usage example - it initializes the m_ControlId field with 
+			// an index of the corresponding 3d vertex in order to avoid duplicated 
+			// vertices in a UV face.
+			uvp_vertex.m_ControlId = static_cast<int>(reinterpret_cast<intptr_t>(point_id));
+
+			// 3d coordinates of the 3d vertex corresponding to the given UV vertex. 
+			// Currently this field is only used when m_NormalizeIslands parameter
+			// is set to true. Otherwise it is ignored by the packer, hence it doesn't
+			// have to be initialized by the application.
+			uvp_vertex.m_Vert3dCoords[0] = position[0];
+			uvp_vertex.m_Vert3dCoords[1] = position[1];
+			uvp_vertex.m_Vert3dCoords[2] = position[2];
+
+			// Check for duplicate entries, as we iterate over each polygon they are likely to have vertices which
+			// have same uv and positional values.
+			auto iterator = gather.m_UvMap.find(uvp_vertex);
+			size_t uvp_vert_index;
+			if (iterator == gather.m_UvMap.end()) 
+			{
+				uvp_vert_index = gather.m_VertArray.size(); // Get the size to update which index we're on.
+				gather.m_UvMap[uvp_vertex] = uvp_vert_index; // Add the pair uvp_vertex, uvp_vert_index to the uv_map
+				gather.m_VertArray.emplace_back(uvp_vertex);// Add the current UvVertT to the back of the array
+				gather.m_PointMap[uvp_vert_index] = point_id;// Store so we can get the point id for a uv vertex.
+			}
+			else 
+			{	// For the found pair, get the second element, which is the previously stored index.
+				uvp_vert_index = (*iterator).second;
+			}
+
+			face.m_Verts.pushBack(uvp_vert_index);
+		}
+		uvp_face_index++;
+	}
+
+	if (polygon_count > 0)
+		progress((polygon_count - 1) % UV_PROGRESS_CHUNK + 1);
+
+	return true;
+}
+
+// Copy over the values from the original input to the new texcoords
+inline void initTexcoords(const std::vector<UvVertT>& verts, std::vector<LXtFVector2>& solved_texcoords)
+{
+	solved_texcoords = std::vector<LXtFVector2>(verts.size());
+	for (size_t i = 0; i < verts.size(); i++)
+	{
+		const UvVertT& origVert = verts[i];
+		solved_texcoords[i][0] = origVert.m_UvCoords[0];
+		solved_texcoords[i][1] = origVert.m_UvCoords[1];
+	}
+}
+
+// Transform the input uvs of every island with a solution into solved_texcoords.
+// IslandsT is indexed by island index and holds indices into faces, the face
+// array that was sent to UVP. SolutionsT is a range of UvpIslandPackSolutionT.
+template <typename IslandsT, typename SolutionsT>
+void applyIslandSolutions(const IslandsT& islands, const SolutionsT& solutions, const std::vector<UvFaceT>& faces, const std::vector<UvVertT>& verts, std::vector<LXtFVector2>& solved_texcoords)
+{
+	for (const UvpIslandPackSolutionT& islandSolution : solutions)
+	{
+		const auto& island = islands[islandSolution.m_IslandIdx];
+
+		// Given a solution from uvp, get 
+		CLxMatrix4 solutionMatrix;
+		islandSolutionToMatrix(islandSolution, solutionMatrix);
+
+		for (int faceId : island)
+		{
+			const UvFaceT& face = faces[faceId];
+
+			for (int vertIdx : face.m_Verts)
+			{
+				const UvVertT& origVert = verts[vertIdx];
+				LXtVector4 input_uv = { origVert.m_UvCoords[0], origVert.m_UvCoords[1], 0.0, 1.0 };
+				LXtVector4 solved_uv;
+
+				mat4x4_mul_vec4(solved_uv, solutionMatrix, input_uv);
+
+				solved_texcoords[vertIdx][0] = solved_uv[0] / solved_uv[3];
+				solved_texcoords[vertIdx][1] = solved_uv[1] / solved_uv[3];
+			}
+		}
+	}
+}
+
+// Compute the solved uv for every vertex. Vertices of islands without a
+// solution keep their input uvs.
+template <typename IslandsT, typename SolutionsT>
+void solveTexcoords(const IslandsT& islands, const SolutionsT& solutions, const std::vector<UvFaceT>& faces, const std::vector<UvVertT>& verts, std::vector<LXtFVector2>& solved_texcoords)
+{
+	initTexcoords(verts, solved_texcoords);
+	applyIslandSolutions(islands, solutions, faces, verts, solved_texcoords);
+}
+
+// Append a copy of face to faces, with the face id set to its new index.
+inline void appendFace(std::vector<UvFaceT>& faces, const UvFaceT& face)
+{
+	faces.emplace_back((int)faces.size());
+	UvFaceT& copy = faces.back();
+	copy.m_InputFlags = face.m_InputFlags;
+	copy.m_Verts.reserve(face.m_Verts.size());
+	for (int vertIdx : face.m_Verts)
+		copy.m_Verts.pushBack(vertIdx);
+}
+
+// Find the uv islands of a face array, faces sharing a uv vertex belong to the
+// same island. Returns the face indices of each island, in face order.
+inline std::vector<std::vector<int>> findIslands(const std::vector<UvVertT>& verts, const std::vector<UvFaceT>& faces)
+{
+	// Union find over the uv vertices, with path halving,
+	std::vector<int> parent(verts.size());
+	for (size_t i = 0; i < parent.size(); i++)
+		parent[i] = (int)i;
+
+	auto find = [&parent](int v)
+	{
+		while (parent[v] != v)
+		{
+			parent[v] = parent[parent[v]];
+			v = parent[v];
+		}
+		return v;
+	};
+
+	for (const UvFaceT& face : faces)
+	{
+		int first = -1;
+		for (int vertIdx : face.m_Verts)
+		{
+			if (first < 0)
+			{
+				first = find(vertIdx);
+				continue;
+			}
+
+			int root = find(vertIdx);
+			if (root != first)
+				parent[root] = first;
+		}
+	}
+
+	// Number the islands in order of their first face,
+	std::vector<int> island_of_root(verts.size(), -1);
+	std::vector<std::vector<int>> islands;
+	for (size_t faceIdx = 0; faceIdx < faces.size(); faceIdx++)
+	{
+		const UvFaceT& face = faces[faceIdx];
+		if (face.m_Verts.size() == 0)
+			continue;
+
+		int root = find(*face.m_Verts.begin());
+		if (island_of_root[root] < 0)
+		{
+			island_of_root[root] = (int)islands.size();
+			islands.emplace_back();
+		}
+		islands[island_of_root[root]].push_back((int)faceIdx);
+	}
+
+	return islands;
+}
+
+// Islands with identical shape collapsed to one representative per group.
+struct UvInstancesT
+{
+	// Faces to send to UVP, faces of instances are left out and the face ids
+	// are renumbered to match the new array.
+	std::vector<UvFaceT> m_FaceArray;
+
+	// Index in the gathered face array of each face in m_FaceArray,
+	std::vector<int> m_FaceSource;
+
+	// For every vertex of an instance, the representative vertex it follows.
+	// -1 for vertices sent to UVP.
+	std::vector<int> m_VertSource;
+
+	// Number of islands left out of m_FaceArray,
+	size_t m_InstanceCount = 0;
+};
+
+// Find selected islands that are the same shape up to a translation in uv
+// space and only keep the first of each. The shape is compared on the face
+// layout and the uvs relative to the island's minimum, quantized to about a
+// millionth of the uv range. With normalizeIslands the 3d area of the islands
+// has to match as well, seeing as UVP would scale them by it. Grouped packs
+// only stack islands of the same group.
+inline void instanceIslands(const UvGatherT& gather, bool normalizeIslands, UvInstancesT& instances)
+{
+	const std::vector<UvVertT>& verts = gather.m_VertArray;
+	const std::vector<UvFaceT>& faces = gather.m_FaceArray;
+	const std::vector<std::vector<int>> islands = findIslands(verts, faces);
+
+	const double quantum = 1.0 / (1 << 20);
+	const int selected = static_cast<int>(uvpcore::UVP_FACE_INPUT_FLAGS::SELECTED);
+
+	// Canonical key for each island, stored back to back in one array,
+	std::vector<int64_t> keys;
+	std::vector<size_t> key_start(islands.size() + 1, 0);
+	std::vector<uint64_t> hashes(islands.size(), 0);
+
+	// Local vertex numbering of the current island, by first use,
+	std::unordered_map<int, int> local;
+
+	for (size_t islandIdx = 0; islandIdx < islands.size(); islandIdx++)
+	{
+		const std::vector<int>& island = islands[islandIdx];
+		key_start[islandIdx] = keys.size();
+
+		// Only fully selected islands can move, so only those are instanced.
+		bool all_selected = true;
+		float min_u = INFINITY, min_v = INFINITY;
+		for (int faceIdx : island)
+		{
+			all_selected &= (faces[faceIdx].m_InputFlags & selected) != 0;
+			for (int vertIdx : faces[faceIdx].m_Verts)
+			{
+				min_u = std::min(min_u, verts[vertIdx].m_UvCoords[0]);
+				min_v = std::min(min_v, verts[vertIdx].m_UvCoords[1]);
+			}
+		}
+		if (!all_selected)
+			continue;
+
+		local.clear();
+		double area3d = 0.0;
+		keys.push_back((int64_t)island.size());
+
+		// Islands of different groups are packed in different boxes, so they
+		// can't stack on each other. Islands go to the group of their first face.
+		if (gather.m_GroupTag)
+			keys.push_back(gather.m_FaceGroup[island.front()]);
+		for (int faceIdx : island)
+		{
+			const UvFaceT& face = faces[faceIdx];
+			keys.push_back((int64_t)face.m_Verts.size());
+
+			const UvVertT* first = nullptr;
+			const UvVertT* prev = nullptr;
+			for (int vertIdx : face.m_Verts)
+			{
+				const UvVertT& vert = verts[vertIdx];
+				auto found = local.emplace(vertIdx, (int)local.size());
+				keys.push_back(found.first->second);
+				keys.push_back(std::llround((vert.m_UvCoords[0] - min_u) / quantum));
+				keys.push_back(std::llround((vert.m_UvCoords[1] - min_v) / quantum));
+
+				// 3d area of the face as a triangle fan, only needed for normalizing
+				if (normalizeIslands)
+				{
+					if (!first)
+						first = &vert;
+					else if (prev != first)
+					{
+						double a[3], b[3];
+						for (int i = 0; i < 3; i++)
+						{
+							a[i] = prev->m_Vert3dCoords[i] - first->m_Vert3dCoords[i];
+							b[i] = vert.m_Vert3dCoords[i] - first->m_Vert3dCoords[i];
+						}
+						double cx = a[1] * b[2] - a[2] * b[1];
+						double cy = a[2] * b[0] - a[0] * b[2];
+						double cz = a[0] * b[1] - a[1] * b[0];
+						area3d += 0.5 * std::sqrt(cx * cx + cy * cy + cz * cz);
+					}
+					prev = &vert;
+				}
+			}
+		}
+
+		// Areas only need to match to about four significant digits,
+		if (normalizeIslands)
+		{
+			int exponent = 0;
+			double mantissa = std::frexp(area3d, &exponent);
+			keys.push_back(exponent);
+			keys.push_back(std::llround(mantissa * 16384.0));
+		}
+
+		// FNV-1a over the key,
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = key_start[islandIdx]; i < keys.size(); i++)
+		{
+			hash ^= (uint64_t)keys[i];
+			hash *= 1099511628211ull;
+		}
+		hashes[islandIdx] = hash;
+	}
+	key_start[islands.size()] = keys.size();
+
+	// Group islands with equal keys, the first island of a group is the representative.
+	std::unordered_map<uint64_t, std::vector<int>> representatives;
+	std::vector<int> instance_of(islands.size(), -1);
+	for (size_t islandIdx = 0; islandIdx < islands.size(); islandIdx++)
+	{
+		size_t begin = key_start[islandIdx];
+		size_t end = key_start[islandIdx + 1];
+		if (begin == end)
+			continue;
+
+		std::vector<int>& candidates = representatives[hashes[islandIdx]];
+		for (int candidate : candidates)
+		{
+			size_t other = key_start[candidate];
+			if (key_start[candidate + 1] - other == end - begin &&
+				std::equal(keys.begin() + begin, keys.begin() + end, keys.begin() + other))
+			{
+				instance_of[islandIdx] = candidate;
+				break;
+			}
+		}
+		if (instance_of[islandIdx] < 0)
+			candidates.push_back((int)islandIdx);
+	}
+
+	// Faces of the same island are visited in the same order for both islands,
+	// so corners match up one to one.
+	instances.m_VertSource.assign(verts.size(), -1);
+	instances.m_InstanceCount = 0;
+
+	std::vector<char> keep_face(faces.size(), 1);
+	for (size_t islandIdx = 0; islandIdx < islands.size(); islandIdx++)
+	{
+		if (instance_of[islandIdx] < 0)
+			continue;
+
+		const std::vector<int>& island = islands[islandIdx];
+		const std::vector<int>& source = islands[instance_of[islandIdx]];
+		for (size_t i = 0; i < island.size(); i++)
+		{
+			const UvFaceT& face = faces[island[i]];
+			const UvFaceT& source_face = faces[source[i]];
+
+			auto vert = face.m_Verts.begin();
+			auto source_vert = source_face.m_Verts.begin();
+			for (; vert != face.m_Verts.end(); ++vert, ++source_vert)
+				instances.m_VertSource[*vert] = *source_vert;
+
+			keep_face[island[i]] = 0;
+		}
+		instances.m_InstanceCount++;
+	}
+
+	// Copy the remaining faces, renumbered so ids match the indices of the new array.
+	instances.m_FaceArray.clear();
+	instances.m_FaceSource.clear();
+	instances.m_FaceArray.reserve(faces.size());
+	for (size_t faceIdx = 0; faceIdx < faces.size(); faceIdx++)
+	{
+		if (!keep_face[faceIdx])
+			continue;
+
+		appendFace(instances.m_FaceArray, faces[faceIdx]);
+		instances.m_FaceSource.push_back((int)faceIdx);
+	}
+}
+
+// Stack every instance on top of its representative, by copying the solved uvs
+// of the representative vertices.
+inline void applyInstances(const UvInstancesT& instances, std::vector<LXtFVector2>& solved_texcoords)
+{
+	for (size_t vertIdx = 0; vertIdx < instances.m_VertSource.size(); vertIdx++)
+	{
+		int source = instances.m_VertSource[vertIdx];
+		if (source < 0)
+			continue;
+
+		solved_texcoords[vertIdx][0] = solved_texcoords[source][0];
+		solved_texcoords[vertIdx][1] = solved_texcoords[source][1];
+	}
+}
+
+// Faces along with only the uv vertices they use, see compactVerts.
+struct UvCompactT
+{
+	// Faces with their vertex indices renumbered into m_VertArray,
+	std::vector<UvFaceT> m_FaceArray;
+	std::vector<UvVertT> m_VertArray;
+
+	// Index in the input vertex array of each vertex in m_VertArray,
+	std::vector<int> m_VertSource;
+};
+
+// Copy faces and the vertices they use, numbered in order of first use. Face
+// ids and flags are kept as they are.
+inline void compactVerts(const std::vector<UvFaceT>& faces, const std::vector<UvVertT>& verts, UvCompactT& compact)
+{
+	std::vector<int> remap(verts.size(), -1);
+	compact.m_FaceArray.clear();
+	compact.m_VertArray.clear();
+	compact.m_VertSource.clear();
+	compact.m_FaceArray.reserve(faces.size());
+
+	for (const UvFaceT& face : faces)
+	{
+		compact.m_FaceArray.emplace_back(face.m_FaceId);
+		UvFaceT& copy = compact.m_FaceArray.back();
+		copy.m_InputFlags = face.m_InputFlags;
+		copy.m_Verts.reserve(face.m_Verts.size());
+		for (int vertIdx : face.m_Verts)
+		{
+			if (remap[vertIdx] < 0)
+			{
+				remap[vertIdx] = (int)compact.m_VertArray.size();
+				compact.m_VertArray.push_back(verts[vertIdx]);
+				compact.m_VertSource.push_back(vertIdx);
+			}
+			copy.m_Verts.pushBack(remap[vertIdx]);
+		}
+	}
+}
+
+// Copy the solved uvs of compacted vertices back to the vertices they came
+// from.
+inline void scatterTexcoords(const UvCompactT& compact, const std::vector<LXtFVector2>& compact_texcoords, std::vector<LXtFVector2>& solved_texcoords)
+{
+	for (size_t i = 0; i < compact.m_VertSource.size(); i++)
+	{
+		solved_texcoords[compact.m_VertSource[i]][0] = compact_texcoords[i][0];
+		solved_texcoords[compact.m_VertSource[i]][1] = compact_texcoords[i][1];
+	}
+}
+
+// Face array with the static islands replaced by proxies, see
+// proxyStaticIslands.
+struct UvProxiesT
+{
+	// Faces to send to UVP, with face ids set to their index,
+	std::vector<UvFaceT> m_FaceArray;
+
+	// Index into the input face array of each face, proxies refer to the
+	// first face of their island.
+	std::vector<int> m_FaceSource;
+
+	size_t m_ProxyCount = 0;
+	size_t m_ReplacedCount = 0;
+};
+
+// Replace every island without selected faces by a single face along the
+// convex hull of its uvs. In pack-to-others mode static islands are only
+// obstacles, so the packed islands still stay clear of them while UVP is spared
+// analyzing the full topology of dense static geometry, at the cost of the
+// space in their concave parts. The hulls use the islands' own vertices.
+// Selected islands, and static islands of one face or with a degenerate hull,
+// are copied as they are.
+inline void proxyStaticIslands(const std::vector<UvVertT>& verts, const std::vector<UvFaceT>& faces, UvProxiesT& proxies)
+{
+	const int selected = static_cast<int>(uvpcore::UVP_FACE_INPUT_FLAGS::SELECTED);
+	const std::vector<std::vector<int>> islands = findIslands(verts, faces);
+
+	auto uv_less = [&](int a, int b)
+	{
+		const float* uv_a = verts[a].m_UvCoords;
+		const float* uv_b = verts[b].m_UvCoords;
+		return uv_a[0] < uv_b[0] || (uv_a[0] == uv_b[0] && uv_a[1] < uv_b[1]);
+	};
+	auto uv_equal = [&](int a, int b)
+	{
+		return verts[a].m_UvCoords[0] == verts[b].m_UvCoords[0] && verts[a].m_UvCoords[1] == verts[b].m_UvCoords[1];
+	};
+	auto cross = [&](int o, int a, int b)
+	{
+		const float* uv_o = verts[o].m_UvCoords;
+		const float* uv_a = verts[a].m_UvCoords;
+		const float* uv_b = verts[b].m_UvCoords;
+		return ((double)uv_a[0] - uv_o[0]) * ((double)uv_b[1] - uv_o[1]) - ((double)uv_a[1] - uv_o[1]) * ((double)uv_b[0] - uv_o[0]);
+	};
+
+	std::vector<char> replaced(faces.size(), 0);
+	std::vector<std::vector<int>> hulls;
+	std::vector<int> hull_source;
+	std::vector<int> points;
+
+	for (const std::vector<int>& island : islands)
+	{
+		bool is_static = island.size() > 1;
+		for (size_t i = 0; i < island.size() && is_static; i++)
+			is_static = (faces[island[i]].m_InputFlags & selected) == 0;
+		if (!is_static)
+			continue;
+
+		points.clear();
+		for (int faceIdx : island)
+			for (int vertIdx : faces[faceIdx].m_Verts)
+				points.push_back(vertIdx);
+
+		// Vertices on a seam share their uvs, keep one of each
+		std::sort(points.begin(), points.end(), uv_less);
+		points.erase(std::unique(points.begin(), points.end(), uv_equal), points.end());
+		if (points.size() < 3)
+			continue;
+
+		// Monotone chain, counter clockwise without collinear points
+		std::vector<int> hull(2 * points.size());
+		size_t k = 0;
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			while (k >= 2 && cross(hull[k - 2], hull[k - 1], points[i]) <= 0.0)
+				k--;
+			hull[k++] = points[i];
+		}
+		for (size_t i = points.size() - 1, lower = k + 1; i > 0; i--)
+		{
+			while (k >= lower && cross(hull[k - 2], hull[k - 1], points[i - 1]) <= 0.0)
+				k--;
+			hull[k++] = points[i - 1];
+		}
+		hull.resize(k - 1);
+		if (hull.size() < 3)
+			continue;
+
+		for (int faceIdx : island)
+			replaced[faceIdx] = 1;
+		hulls.push_back(std::move(hull));
+		hull_source.push_back(island.front());
+		proxies.m_ReplacedCount += island.size();
+	}
+
+	proxies.m_FaceArray.reserve(faces.size() - proxies.m_ReplacedCount + hulls.size());
+	for (size_t faceIdx = 0; faceIdx < faces.size(); faceIdx++)
+	{
+		if (replaced[faceIdx])
+			continue;
+		appendFace(proxies.m_FaceArray, faces[faceIdx]);
+		proxies.m_FaceSource.push_back((int)faceIdx);
+	}
+
+	for (size_t i = 0; i < hulls.size(); i++)
+	{
+		proxies.m_FaceArray.emplace_back((int)proxies.m_FaceArray.size());
+		UvFaceT& face = proxies.m_FaceArray.back();
+		face.m_InputFlags = 0;
+		face.m_Verts.reserve((SizeT)hulls[i].size());
+		for (int vertIdx : hulls[i])
+			face.m_Verts.pushBack(vertIdx);
+		proxies.m_FaceSource.push_back(hull_source[i]);
+	}
+	proxies.m_ProxyCount = hulls.size();
+}
+
+// Islands split into partitions that are packed separately, see
+// CCommand::packPartitions. Every partition only holds the vertices its faces
+// use, so each operation gets no more uv data than it packs.
+struct UvPartitionT
+{
+	// Faces of each partition, with face ids renumbered per partition,
+	std::vector<UvCompactT> m_Parts;
+
+	// Faces of islands not assigned to any partition, these stay in place.
+	UvCompactT m_Static;
+};
+
+// Split islands into partitions, islandPart holds the partition of each island
+// or -1 to leave the island static. Partitions without islands are dropped.
+inline void partitionIslands(const std::vector<UvVertT>& verts, const std::vector<std::vector<int>>& islands, const std::vector<UvFaceT>& faces, const std::vector<int>& islandPart, int partCount, UvPartitionT& partition)
+{
+	std::vector<std::vector<UvFaceT>> parts(partCount);
+	std::vector<UvFaceT> static_faces;
+
+	for (size_t islandIdx = 0; islandIdx < islands.size(); islandIdx++)
+	{
+		int part = islandPart[islandIdx];
+		std::vector<UvFaceT>& target = part < 0 ? static_faces : parts[part];
+		for (int faceIdx : islands[islandIdx])
+			appendFace(target, faces[faceIdx]);
+	}
+
+	partition.m_Parts.clear();
+	for (std::vector<UvFaceT>& part : parts)
+	{
+		if (part.empty())
+			continue;
+
+		partition.m_Parts.emplace_back();
+		compactVerts(part, verts, partition.m_Parts.back());
+		std::vector<UvFaceT>().swap(part);
+	}
+	compactVerts(static_faces, verts, partition.m_Static);
+}
+
+// Partition islands by group, faceGroup holds the group of each face. An island
+// goes to the group of its first face, so islands spanning several groups are
+// kept whole. Islands without selected faces are left static.
+inline void partitionGroups(const std::vector<UvVertT>& verts, const std::vector<UvFaceT>& faces, const std::vector<int>& faceGroup, int groupCount, UvPartitionT& partition)
+{
+	const std::vector<std::vector<int>> islands = findIslands(verts, faces);
+	const int selected = static_cast<int>(uvpcore::UVP_FACE_INPUT_FLAGS::SELECTED);
+
+	std::vector<int> islandPart(islands.size(), -1);
+	for (size_t islandIdx = 0; islandIdx < islands.size(); islandIdx++)
+	{
+		for (int faceIdx : islands[islandIdx])
+		{
+			if (faces[faceIdx].m_InputFlags & selected)
+			{
+				islandPart[islandIdx] = faceGroup[islands[islandIdx].front()];
+				break;
+			}
+		}
+	}
+
+	partitionIslands(verts, islands, faces, islandPart, groupCount, partition);
+}
+
+// Islands in a pack above which uvp.pack packs hierarchically by default, and
+// about how many islands go in each cluster. UVP slows down steeply with the
+// island count, packing clusters of this size concurrently scales far better.
+static const size_t UV_HIERARCHY_ISLAND_COUNT = 10000;
+static const size_t UV_CLUSTER_ISLAND_COUNT = 2000;
+
+// Number of islands with selected faces, the ones UVP moves.
+inline size_t countSelectedIslands(const std::vector<std::vector<int>>& islands, const std::vector<UvFaceT>& faces)
+{
+	const int selected = static_cast<int>(uvpcore::UVP_FACE_INPUT_FLAGS::SELECTED);
+
+	size_t count = 0;
+	for (const std::vector<int>& island : islands)
+	{
+		for (int faceIdx : island)
+		{
+			if (faces[faceIdx].m_InputFlags & selected)
+			{
+				count++;
+				break;
+			}
+		}
+	}
+	return count;
+}
+
+// Partition the islands with selected faces into clusterCount clusters of
+// neighbouring islands, for hierarchical packing. Islands are ordered along a
+// Morton curve through the centers of their uv bounds and cut into runs of
+// the same island count. Islands without selected faces are left static.
+inline void clusterIslands(const std::vector<UvVertT>& verts, const std::vector<UvFaceT>& faces, const std::vector<std::vector<int>>& islands, int clusterCount, UvPartitionT& partition)
+{
+	const int selected = static_cast<int>(uvpcore::UVP_FACE_INPUT_FLAGS::SELECTED);
+
+	std::vector<int> islandPart(islands.size(), -1);
+	std::vector<float> centers(2 * islands.size());
+	std::vector<int> movable;
+
+	float min[2] = { INFINITY, INFINITY };
+	float max[2] = { -INFINITY, -INFINITY };
+	for (size_t islandIdx = 0; islandIdx < islands.size(); islandIdx++)
+	{
+		bool is_selected = false;
+		float island_min[2] = { INFINITY, INFINITY };
+		float island_max[2] = { -INFINITY, -INFINITY };
+		for (int faceIdx : islands[islandIdx])
+		{
+			is_selected |= (faces[faceIdx].m_InputFlags & selected) != 0;
+			for (int vertIdx : faces[faceIdx].m_Verts)
+			{
+				for (int i = 0; i < 2; i++)
+				{
+					island_min[i] = std::min(island_min[i], verts[vertIdx].m_UvCoords[i]);
+					island_max[i] = std::max(island_max[i], verts[vertIdx].m_UvCoords[i]);
+				}
+			}
+		}
+		if (!is_selected)
+			continue;
+
+		movable.push_back((int)islandIdx);
+		for (int i = 0; i < 2; i++)
+		{
+			centers[2 * islandIdx + i] = (island_min[i] + island_max[i]) * 0.5f;
+			min[i] = std::min(min[i], centers[2 * islandIdx + i]);
+			max[i] = std::max(max[i], centers[2 * islandIdx + i]);
+		}
+	}
+
+	// Interleave the bits of the centers quantized to 16 bits per axis,
+	auto morton = [&](int islandIdx)
+	{
+		uint64_t code = 0;
+		for (int i = 0; i < 2; i++)
+		{
+			float range = max[i] - min[i];
+			float t = range > 0.0f ? (centers[2 * islandIdx + i] - min[i]) / range : 0.0f;
+			uint64_t q = (uint64_t)std::min(65535.0f, std::max(0.0f, t * 65535.0f));
+			for (int bit = 0; bit < 16; bit++)
+				code |= ((q >> bit) & 1) << (2 * bit + i);
+		}
+		return code;
+	};
+
+	std::vector<std::pair<uint64_t, int>> order;
+	order.reserve(movable.size());
+	for (int islandIdx : movable)
+		order.emplace_back(morton(islandIdx), islandIdx);
+	std::sort(order.begin(), order.end());
+
+	clusterCount = std::max(1, clusterCount);
+	for (size_t i = 0; i < order.size(); i++)
+		islandPart[order[i].second] = (int)(i * clusterCount / order.size());
+
+	partitionIslands(verts, islands, faces, islandPart, clusterCount, partition);
+}
+
+// Bounding box of the solved uvs used by a face array,
+inline void solvedBounds(const std::vector<UvFaceT>& faces, const std::vector<LXtFVector2>& solved_texcoords, float min[2], float max[2])
+{
+	min[0] = min[1] = INFINITY;
+	max[0] = max[1] = -INFINITY;
+	for (const UvFaceT& face : faces)
+	{
+		for (int vertIdx : face.m_Verts)
+		{
+			for (int i = 0; i < 2; i++)
+			{
+				min[i] = std::min(min[i], solved_texcoords[vertIdx][i]);
+				max[i] = std::max(max[i], solved_texcoords[vertIdx][i]);
+			}
+		}
+	}
+}
+
+// Total uv area of a face array, using the solved uvs if given and the input
+// uvs otherwise. With selectedOnly, faces UVP leaves static are not counted.
+inline double uvArea(const std::vector<UvFaceT>& faces, const std::vector<UvVertT>& verts, const std::vector<LXtFVector2>* solved_texcoords, bool selectedOnly)
+{
+	const int selected = static_cast<int>(uvpcore::UVP_FACE_INPUT_FLAGS::SELECTED);
+
+	auto uv = [&](int vertIdx, int i)
+	{
+		return solved_texcoords ? (double)(*solved_texcoords)[vertIdx][i] : (double)verts[vertIdx].m_UvCoords[i];
+	};
+
+	double area = 0.0;
+	for (const UvFaceT& face : faces)
+	{
+		if (selectedOnly && !(face.m_InputFlags & selected))
+			continue;
+
+		// Shoelace formula, faces can be wound either way
+		double face_area = 0.0;
+		int prev = -1;
+		int first = -1;
+		for (int vertIdx : face.m_Verts)
+		{
+			if (prev < 0)
+				first = vertIdx;
+			else
+				face_area += uv(prev, 0) * uv(vertIdx, 1) - uv(vertIdx, 0) * uv(prev, 1);
+			prev = vertIdx;
+		}
+		if (prev >= 0)
+			face_area += uv(prev, 0) * uv(first, 1) - uv(first, 0) * uv(prev, 1);
+
+		area += std::abs(face_area) * 0.5;
+	}
+
+	return area;
+}
+
+// Total 3d area of a face array, with faces split into triangle fans.
+inline double area3d(const std::vector<UvFaceT>& faces, const std::vector<UvVertT>& verts)
+{
+	double area = 0.0;
+	for (const UvFaceT& face : faces)
+	{
+		const UvVertT* first = nullptr;
+		const UvVertT* prev = nullptr;
+		for (int vertIdx : face.m_Verts)
+		{
+			const UvVertT& vert = verts[vertIdx];
+			if (!first)
+				first = &vert;
+			else if (prev != first)
+			{
+				double a[3], b[3];
+				for (int i = 0; i < 3; i++)
+				{
+					a[i] = prev->m_Vert3dCoords[i] - first->m_Vert3dCoords[i];
+					b[i] = vert.m_Vert3dCoords[i] - first->m_Vert3dCoords[i];
+				}
+				double cx = a[1] * b[2] - a[2] * b[1];
+				double cy = a[2] * b[0] - a[0] * b[2];
+				double cz = a[0] * b[1] - a[1] * b[0];
+				area += 0.5 * std::sqrt(cx * cx + cy * cy + cz * cz);
+			}
+			prev = &vert;
+		}
+	}
+	return area;
+}
+
+// Size of each partition as UVP scales it, the 3d area with normalizeIslands
+// and the input uv area otherwise. Texel density is solved area over size.
+inline std::vector<double> partitionSizes(const UvPartitionT& partition, bool normalizeIslands)
+{
+	std::vector<double> sizes;
+	for (const UvCompactT& part : partition.m_Parts)
+		sizes.push_back(normalizeIslands ? area3d(part.m_FaceArray, part.m_VertArray) : uvArea(part.m_FaceArray, part.m_VertArray, nullptr, false));
+	return sizes;
+}
+
+// Inputs packing every partition on its own into the unit square. With
+// stretch the box pass scales each partition to about the square root of its
+// share of the total size, so margins, which UVP measures in the unit square,
+// are scaled by the inverse up front and come out as asked for.
+inline void partitionInputs(const UvpOperationInputT& baseInput, const UvPartitionT& partition, const std::vector<double>& sizes, std::vector<UvpOperationInputT>& inputs)
+{
+	double total = 0.0;
+	for (double size : sizes)
+		total += size;
+
+	inputs.assign(partition.m_Parts.size(), baseInput);
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		const UvCompactT& part = partition.m_Parts[i];
+		UvpOperationInputT& input = inputs[i];
+		input.m_PackToOthers = false;
+		input.m_ProcessUnselected = false;
+		input.m_UvData.m_FaceCount = part.m_FaceArray.size();
+		input.m_UvData.m_pFaceArray = const_cast<UvFaceT*>(part.m_FaceArray.data());
+		input.m_UvData.m_VertCount = part.m_VertArray.size();
+		input.m_UvData.m_pVertArray = const_cast<UvVertT*>(part.m_VertArray.data());
+
+		double box_scale = total > 0.0 ? std::sqrt(sizes[i] / total) : 1.0;
+		if (!baseInput.m_FixedScale && box_scale > 0.0)
+		{
+			input.m_Margin = (float)(baseInput.m_Margin / box_scale);
+			input.m_PixelMarginTextureSize = std::max(1, (int)std::lround(baseInput.m_PixelMarginTextureSize * box_scale));
+		}
+	}
+}
+
+// Scale the solved partitions about the minimum of their bounds, so they all
+// end up at the texel density of the partitions taken together. The box pass
+// then scales every box by the same factor, keeping the density shared as it
+// would be in a single pack. part_texcoords holds the solved uvs of each
+// partition's own vertices.
+inline void equalizePartitionDensity(const UvPartitionT& partition, const std::vector<double>& sizes, std::vector<std::vector<LXtFVector2>>& part_texcoords)
+{
+	const size_t part_count = partition.m_Parts.size();
+
+	std::vector<double> solved_areas(part_count);
+	double total_solved = 0.0, total_size = 0.0;
+	for (size_t i = 0; i < part_count; i++)
+	{
+		solved_areas[i] = uvArea(partition.m_Parts[i].m_FaceArray, partition.m_Parts[i].m_VertArray, &part_texcoords[i], false);
+		total_solved += solved_areas[i];
+		total_size += sizes[i];
+	}
+	if (total_solved <= 0.0 || total_size <= 0.0)
+		return;
+
+	const double density = std::sqrt(total_solved / total_size);
+	for (size_t i = 0; i < part_count; i++)
+	{
+		if (solved_areas[i] <= 0.0 || sizes[i] <= 0.0)
+			continue;
+
+		float scale = (float)(density / std::sqrt(solved_areas[i] / sizes[i]));
+		float min[2], max[2];
+		solvedBounds(partition.m_Parts[i].m_FaceArray, part_texcoords[i], min, max);
+		for (LXtFVector2& uv : part_texcoords[i])
+		{
+			for (int j = 0; j < 2; j++)
+				uv[j] = min[j] + (uv[j] - min[j]) * scale;
+		}
+	}
+}
+
+// Uv data of the box pass, one quad per partition around its solved uvs,
+// appended after the static vertices so the static faces keep their vertex
+// indices. Face ids of the quads are the partition indices.
+inline void partitionBoxes(const UvPartitionT& partition, const std::vector<std::vector<LXtFVector2>>& part_texcoords, std::vector<UvVertT>& box_verts, std::vector<UvFaceT>& box_faces)
+{
+	box_verts = partition.m_Static.m_VertArray;
+	box_faces.clear();
+	for (size_t i = 0; i < partition.m_Parts.size(); i++)
+	{
+		float min[2], max[2];
+		solvedBounds(partition.m_Parts[i].m_FaceArray, part_texcoords[i], min, max);
+
+		box_faces.emplace_back((int)i);
+		UvFaceT& face = box_faces.back();
+		face.m_InputFlags = static_cast<int>(uvpcore::UVP_FACE_INPUT_FLAGS::SELECTED);
+
+		const float corners[4][2] = { { min[0], min[1] }, { max[0], min[1] }, { max[0], max[1] }, { min[0], max[1] } };
+		for (const auto& corner : corners)
+		{
+			UvVertT vert;
+			vert.m_UvCoords[0] = corner[0];
+			vert.m_UvCoords[1] = corner[1];
+			vert.m_Vert3dCoords[0] = corner[0];
+			vert.m_Vert3dCoords[1] = corner[1];
+			vert.m_Vert3dCoords[2] = 0.0f;
+			vert.m_ControlId = -(int)box_verts.size(); // never matches a Modo point
+			face.m_Verts.pushBack((int)box_verts.size());
+			box_verts.push_back(vert);
+		}
+	}
+	for (const UvFaceT& face : partition.m_Static.m_FaceArray)
+		appendFace(box_faces, face);
+}
+
+// Input of the box pass. Stretch is kept as asked for, but normalizing the
+// boxes by their made up 3d area would break the shared density.
+inline UvpOperationInputT partitionBoxInput(const UvpOperationInputT& baseInput, const UvPartitionT& partition, std::vector<UvVertT>& box_verts, std::vector<UvFaceT>& box_faces)
+{
+	UvpOperationInputT input(baseInput);
+	input.m_NormalizeIslands = false;
+	input.m_PackToOthers = !partition.m_Static.m_FaceArray.empty();
+	input.m_ProcessUnselected = !partition.m_Static.m_FaceArray.empty();
+	input.m_UvData.m_FaceCount = box_faces.size();
+	input.m_UvData.m_pFaceArray = box_faces.data();
+	input.m_UvData.m_VertCount = box_verts.size();
+	input.m_UvData.m_pVertArray = box_verts.data();
+	return input;
+}
+
+// Move every partition along with its solved box, on top of its own solution,
+// and write the result to the vertices the partition's vertices came from.
+inline void applyPartitionBoxes(const UvpIslandsMessageT& islandsMsg, const UvpPackSolutionMessageT& packSolutionMsg, const UvPartitionT& partition, const std::vector<std::vector<LXtFVector2>>& part_texcoords, std::vector<LXtFVector2>& solved_texcoords)
+{
+	const size_t part_count = partition.m_Parts.size();
+
+	for (const UvpIslandPackSolutionT& islandSolution : packSolutionMsg.m_IslandSolutions)
+	{
+		CLxMatrix4 solutionMatrix;
+		islandSolutionToMatrix(islandSolution, solutionMatrix);
+
+		for (int faceId : islandsMsg.m_Islands[islandSolution.m_IslandIdx])
+		{
+			if (faceId >= (int)part_count)
+				continue;
+
+			const UvCompactT& part = partition.m_Parts[faceId];
+			for (size_t vertIdx = 0; vertIdx < part.m_VertSource.size(); vertIdx++)
+			{
+				LXtVector4 input_uv = { part_texcoords[faceId][vertIdx][0], part_texcoords[faceId][vertIdx][1], 0.0, 1.0 };
+				LXtVector4 solved_uv;
+
+				mat4x4_mul_vec4(solved_uv, solutionMatrix, input_uv);
+
+				solved_texcoords[part.m_VertSource[vertIdx]][0] = solved_uv[0] / solved_uv[3];
+				solved_texcoords[part.m_VertSource[vertIdx]][1] = solved_uv[1] / solved_uv[3];
+			}
+		}
+	}
+}
+
+// How sweep variants are ranked, the sweepMetric argument of uvp.pack.
+enum SweepMetricT
+{
+	SWEEP_COVERAGE = 0,
+	SWEEP_SCALE
+};
+
+// Score of a solved sweep variant, higher is better. Coverage is the solved uv
+// area in the unit square, scale is how much the islands UVP moved grew or
+// shrank, with inputArea their uv area before packing. selectedOnly is set
+// when UVP leaves unselected faces in place.
+inline double sweepScore(int metric, const std::vector<UvFaceT>& faces, const std::vector<UvVertT>& verts, const std::vector<LXtFVector2>& solved_texcoords, bool selectedOnly, double inputArea)
+{
+	if (metric == SWEEP_SCALE)
+		return inputArea > 0.0 ? uvArea(faces, verts, &solved_texcoords, selectedOnly) / inputArea : 0.0;
+
+	return uvArea(faces, verts, &solved_texcoords, false);
+}
+
+// Settings to try in a parameter sweep, starting with base itself. Margin varies
+// fastest, then rotation step, island normalization and last fixed scale, so
+// the first few variants stay close to what the user asked for. The margin and
+// stretch of base are lower bounds: fixed scale is only ever turned on, never
+// off, and margins only grow. Margins are only varied with varyMargins and
+// without a pixel margin, which overrides them, and rotation only if orient is
+// enabled. Values that come out the same, like a grown margin of 0, are only
+// tried once. Returns at most count variants.
+inline std::vector<UvpOperationInputT> sweepVariants(const UvpOperationInputT& base, int count, bool varyMargins)
+{
+	auto add_unique = [](auto& values, auto value)
+	{
+		if (std::find(values.begin(), values.end(), value) == values.end())
+			values.push_back(value);
+	};
+
+	std::vector<float> margins = { base.m_Margin };
+	if (varyMargins && base.m_PixelMargin <= 0.0f)
+	{
+		add_unique(margins, base.m_Margin * 1.5f);
+		add_unique(margins, base.m_Margin * 2.0f);
+	}
+
+	std::vector<int> rotation_steps = { base.m_RotationStep };
+	if (!base.m_PrerotDisable || base.m_RotationStep != 0)
+	{
+		add_unique(rotation_steps, 90);
+		add_unique(rotation_steps, 45);
+	}
+
+	std::vector<bool> normalizes = { base.m_NormalizeIslands };
+	add_unique(normalizes, !base.m_NormalizeIslands);
+
+	std::vector<bool> fixed_scales = { base.m_FixedScale };
+	if (!base.m_FixedScale)
+		add_unique(fixed_scales, true);
+
+	std::vector<UvpOperationInputT> variants;
+	for (bool fixed_scale : fixed_scales)
+		for (bool normalize : normalizes)
+			for (int rotation_step : rotation_steps)
+				for (float margin : margins)
+				{
+					if ((int)variants.size() >= count)
+						return variants;
+
+					variants.push_back(base);
+					variants.back().m_FixedScale = fixed_scale;
+					variants.back().m_NormalizeIslands = normalize;
+					variants.back().m_RotationStep = rotation_step;
+					variants.back().m_Margin = margin;
+				}
+
+	return variants;
+}
+
+// Write the solved uvs back to the selected polygons of a layer. MeshT is the
+// same accessor wrapper as for gatherLayer. Returns false if progress asked to
+// abort, with the layer partly written.
+template <typename MeshT, typename ProgressT = UvNoProgressT>
+bool writeLayer(MeshT& mesh, const UvGatherT& gather, const std::vector<LXtFVector2>& solved_texcoords, ProgressT&& progress = ProgressT())
+{
+	// For each polygon, set the uv for selected polygons,
+	unsigned polygon_count = mesh.polygonCount();
+	for (unsigned polygon_index = 0; polygon_index < polygon_count; polygon_index++)
+	{
+		if (polygon_index > 0 && polygon_index % UV_PROGRESS_CHUNK == 0 && progress(UV_PROGRESS_CHUNK))
+			return false;
+
+		mesh.selectPolygon(polygon_index);
+		LXtPolygonID polygon_id = mesh.polygonID();
+
+		// Just skip this polygon if not selected,
+		if (!mesh.polygonSelected())
+			continue;
+
+		// Find the index for the current polygon in the polygon map,
+		// the second element should hold index to solved uv face. Hidden
+		// polygons were never gathered, so they are left alone.
+		auto iterator = gather.m_PolygonMap.find(polygon_id);
+		if (iterator == gather.m_PolygonMap.end())
+			continue;
+
+		// For each vertex in face, set the solved uv coordinates. Duplicate checks should already been made so 
+		const UvFaceT& uv_face = gather.m_FaceArray[iterator->second];
+		for (const int vert_index : uv_face.m_Verts)
+		{
+			// Find the stored point id for the uv vertex and set the map value
+			auto point_id_lookup = gather.m_PointMap.find(vert_index);
+			if (point_id_lookup != gather.m_PointMap.end())
+				mesh.setUV((*point_id_lookup).second, solved_texcoords[vert_index]);
+		}
+	}
+
+	return polygon_count == 0 || !progress((polygon_count - 1) % UV_PROGRESS_CHUNK + 1);
+}
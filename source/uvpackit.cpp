@@ -1,10 +1,12 @@
 #include <string>
 #include <array>
 #include <unordered_map>
+#include <cmath>
 
 #include <thread>
 #include <future>
 #include <chrono>
+#include <memory>
 
 // UV Packmaster
 #include <uvpCore.hpp> 
@@ -28,258 +30,197 @@
 // Modo SDK for performing layerscan,
 #include <lx_layer.hpp>
 #include <lx_mesh.hpp>
+#include <lx_item.hpp>
 
 #include <algorithm>
 
-using namespace uvpcore;
-using namespace lx_err; // gives us check()
+// Gather, validation and write-back stages shared with the benchmarks,
+#include "uvp_stages.hpp"
+
+// Wrapper for running UVP operations, shared with the replay tool
+#include "uvp_executor.hpp"
 
-// UV Packmaster Related classes, slightly tweaked from their FBX example,
-// url: https://uvpackmaster.com/sdkdoc/90-sample-application/
+// Capture files of the pack input, see tools/uvpackit_replay.cpp
+#include "uvp_capture.hpp"
 
-typedef std::array<UvpMessageT*, static_cast<int>(UvpMessageT::MESSAGE_CODE::VALUE_COUNT)> UvpMessageArrayT;
-void opExecutorMessageHandler(void* m_pMessageHandlerData, UvpMessageT* pMsg);
+using namespace uvpcore;
+using namespace lx_err; // gives us check()
 
-// Wrapper class simplifying execution of UVP operations.
-class UvpOpExecutorT
+// Apply the packing solution received by the executor to the uvs of faces,
+// the face array the executor was given.
+void applyExecutorSolution(UvpOpExecutorT& executor, const std::vector<UvFaceT>& faces, const std::vector<UvVertT>& verts, std::vector<LXtFVector2>& solved_texcoords)
 {
-private:
-	friend void opExecutorMessageHandler(void* m_pMessageHandlerData, UvpMessageT* pMsg);
+	const UvpIslandsMessageT* pIslandsMsg = static_cast<const UvpIslandsMessageT*>(executor.getLastMessage(UvpMessageT::MESSAGE_CODE::ISLANDS));
+	const UvpPackSolutionMessageT* pPackSolutionMsg = static_cast<const UvpPackSolutionMessageT*>(executor.getLastMessage(UvpMessageT::MESSAGE_CODE::PACK_SOLUTION));
 
-	std::list<UvpMessageT*> m_ReceivedMessages;
-	UvpMessageArrayT m_LastMessagePerCode;
+	applyIslandSolutions(pIslandsMsg->m_Islands, pPackSolutionMsg->m_IslandSolutions, faces, verts, solved_texcoords);
+}
 
-	bool m_DebugMode;
+// |======================================================================|
+// | UV Packmaster related stuff should now be implemented, below is Modo |
+// |======================================================================|
 
-	UvpOperationT* operation = nullptr;
+#define SRVNAME_COMMAND	"uvp.pack" // Define for our command name,
 
-	void destroyMessages()
-	{
-		// The application becomes the owner of UVP messages after receiving it,
-		// so we have to make sure they are eventually deallocated by calling
-		// the destory method on them (do not use the delete operator).
-		for (UvpMessageT* pMsg : m_ReceivedMessages)
-		{
-			pMsg->destroy();
-		}
-		m_ReceivedMessages.clear();
-	}
+// Add an entry to the Master Log so users can read it in the Event Log
+void logMessage(LxResult type, const std::string& message)
+{
+	CLxUser_Log log;
+	CLxUser_LogService log_service;
+	CLxUser_LogEntry entry;
 
-	void reset()
-	{
-		destroyMessages();
-		m_LastMessagePerCode = { nullptr };
-	}
+	log_service.GetSubSystem(LXsLOG_LOGSYS, log);
+	log_service.NewEntry(type, message.c_str(), entry);
+	log.AddEntry(entry);
+}
 
-	// This method is called every time the packer sends a message to the application.
-	// We need to handle the message properly.
-	// https://uvpackmaster.com/sdkdoc/20-communication-with-the-packer/
-	void handleMessage(UvpMessageT* pMsg)
-	{
-		if (pMsg->m_Code == UvpMessageT::MESSAGE_CODE::PROGRESS_REPORT)
-		{
-			UvpProgressReportMessageT* pReportProgressMsg = static_cast<UvpProgressReportMessageT*>(pMsg);
+class UVMapVisitor : public CLxImpl_AbstractVisitor
+{
+	CLxUser_MeshMap* vmap;
+	std::set<std::string> names;
 
-			for (int i = 0; i < pReportProgressMsg->m_ProgressSize; i++)
-			{
-				// m_ProgressArray, An array which stores actual progress information. 
-				// It contains m_ProgressSize integers ranging from 0 to 100 (percent).
-				// Get the progress % from the message,
-				unsigned progress = pReportProgressMsg->m_ProgressArray[i];
-
-				// Get a local variable for the atomic uints, to shield
-				// against us overwriting the progress with a lower value
-				// causing the monitor to loop forever.
-				unsigned current = 0;
-
-				// Set the public facing progress so main thread can 
-				// update the progress bar.
-				switch (pReportProgressMsg->m_PackingPhase)
-				{
-				case uvpcore::UVP_PACKING_PHASE_CODE::TOPOLOGY_ANALYSIS:
-					current = topology_progress;
-					topology_progress = (progress > current ? progress : current);
-					break;
-				// PACKING and PIXEL_MARGIN_ADJUSTMENT will both push our progress bar
-				// seeing how PACKING will run when using `margin` and PIXEL_MARGIN_ADJUSTMENT
-				// will enter if users specify the pixels for margin/padding
-				case uvpcore::UVP_PACKING_PHASE_CODE::PACKING:
-				case uvpcore::UVP_PACKING_PHASE_CODE::PIXEL_MARGIN_ADJUSTMENT:
-					current = packing_progress;
-					packing_progress = (progress > current ? progress : current);
-					break;
-				default:
-					break;
-				}
-			}
+	virtual LxResult Evaluate()
+	{
+		const char* mapName;
+		if (LXx_OK(vmap->Name(&mapName))) {
+			names.insert(std::string(mapName));
 		}
-		m_LastMessagePerCode[static_cast<int>(pMsg->m_Code)] = pMsg;
-		m_ReceivedMessages.push_back(pMsg);
+		return LXe_OK;
 	}
 
 public:
-	// Thread safe uints to track progress of different phases,
-	std::atomic_uint topology_progress = 0;
-	std::atomic_uint packing_progress = 0;
+	UVMapVisitor(CLxUser_MeshMap* vmap) { this->vmap = vmap; }
+	std::set<std::string> GetNames() { return names; }
+	void ClearNames() { names.clear(); }
+};
 
-	UvpOpExecutorT(bool debugMode) :
-		m_DebugMode(debugMode)
+// Wraps the Modo mesh accessors for gatherLayer and writeLayer in uvp_stages.hpp,
+// the accessors must already be initialized from the mesh.
+class ModoMeshAccessT
+{
+	CLxUser_Mesh& m_Mesh;
+	CLxUser_Polygon& m_Polygon;
+	CLxUser_Point& m_Point;
+	LXtMeshMapID m_VMapId;
+	unsigned m_SelectMode;
+	unsigned m_HiddenMode;
+
+public:
+	ModoMeshAccessT(CLxUser_Mesh& mesh, CLxUser_Polygon& polygon, CLxUser_Point& point, LXtMeshMapID vmapId, unsigned selectMode, unsigned hiddenMode) :
+		m_Mesh(mesh), m_Polygon(polygon), m_Point(point), m_VMapId(vmapId), m_SelectMode(selectMode), m_HiddenMode(hiddenMode)
 	{}
 
-	~UvpOpExecutorT()
+	unsigned polygonCount()
 	{
-		destroyMessages();
-		if (operation != nullptr)
-			delete operation;
+		unsigned count = 0;
+		m_Mesh.PolygonCount(&count);
+		return count;
 	}
 
-	UVP_ERRORCODE execute(UvpOperationInputT& uvpInput)
-	{
-		reset();
-
-		uvpInput.m_pMessageHandler = opExecutorMessageHandler;
-		uvpInput.m_pMessageHandlerData = this;
-
-		if (m_DebugMode)
-		{
-			// Check whether the application configurated the operation input properly.
-			// WARNING: this operation is time consuming (in particular it iterates over all UV data),
-			// that is why it should only be executed when debugging the application. It should
-			// never be used in production.
-			// https://uvpackmaster.com/sdkdoc/40-uv-map-format/
-			const char* pValidationResult = uvpInput.validate();
-
-			// This runtime error will be caught inside the ccommand::execute when getting result from future,
-			if (pValidationResult)
-			{
-				throw std::runtime_error("UVP Operation input validation failed: " + std::string(pValidationResult));
-			}
-		}
-
-		operation = new UvpOperationT(uvpInput);
+	void selectPolygon(unsigned index) { m_Polygon.SelectByIndex(index); }
+	LXtPolygonID polygonID() { return m_Polygon.ID(); }
 
-		// Start actual execution of the operation. This method wont return
-		// until the operation is done, so it must be called from a different
-		// thread, if you dont want your application to be blocked.
-		// https://uvpackmaster.com/sdkdoc/10-classes/10-uvpoperationt/#ID_entry
-		UVP_ERRORCODE retCode = operation->entry();
+	bool polygonHidden() { return CLxResult(m_Polygon.TestMarks(m_HiddenMode)).isTrue(); }
+	bool polygonSelected() { return CLxResult(m_Polygon.TestMarks(m_SelectMode)).isTrue(); }
 
-		// Being done, to ensure we don't get stuck with the monitor let's set
-		// all progress to 100,
-		topology_progress = 100;
-		packing_progress = 100;
-
-		return retCode;
+	unsigned vertexCount()
+	{
+		unsigned count = 0;
+		m_Polygon.VertexCount(&count);
+		return count;
 	}
 
-	UvpMessageT* getLastMessage(UvpMessageT::MESSAGE_CODE code)
+	LXtPointID vertexByIndex(unsigned index)
 	{
-		return m_LastMessagePerCode[static_cast<int>(code)];
+		LXtPointID point_id;
+		m_Polygon.VertexByIndex(index, &point_id);
+		return point_id;
 	}
 
-	void cancel()
+	bool evaluateUV(LXtPointID point_id, LXtFVector2 texcoords)
 	{
-		if (operation == nullptr)
-			return;
-
-		// Send a signal to the packer that it should stop further execution.
-		// This method only sends a signal and returns immediately - in 
-		// particular returning from this method doesnt indicate that the 
-		// packer already stopped the operation. After executing the cancel 
-		// method you can expect that the call to the entry method will return
-		// in a very short time (possibly with the return code set to CANCELLED).
-		operation->cancel();
+		return m_Polygon.MapEvaluate(m_VMapId, point_id, texcoords) == LXe_OK;
 	}
-};
-
-void opExecutorMessageHandler(void* m_pMessageHandlerData, UvpMessageT* pMsg)
-{
-	// This handler is called every time the packer sends a message to the application.
-	// Simply pass the message to the underlaying executor object.
-	reinterpret_cast<UvpOpExecutorT*>(m_pMessageHandlerData)->handleMessage(pMsg);
-}
 
-// In place translation for matrix m
-void translate_in_place(CLxMatrix4& m, float x, float y, float z)
-{
-	LXtVector4 t = { x, y, z, 0.0 };
-
-	// For each row in matrix, increment the translate xyzw with row dot t
-	for (int i = 0; i < 3; i++) {
-		LXtVector4 r = { m[i][0], m[i][1], m[i][2], m[i][3] };
-		m.set(i, 3, m[i][3] + LXx_V4DOT(t, r));
+	void position(LXtPointID point_id, LXtFVector position)
+	{
+		m_Point.Select(point_id);
+		m_Point.Pos(position);
 	}
-}
 
-// anisotropic scaling of matrix m
-void scale_aniso(CLxMatrix4& m, float x, float y, float z)
-{
-	m.set(
-		m[0][0] * x, m[0][1] * y, m[0][2] * z, m[0][3],
-		m[1][0] * x, m[1][1] * y, m[1][2] * z, m[1][3],
-		m[2][0] * x, m[2][1] * y, m[2][2] * z, m[2][3],
-		m[3][0] * x, m[3][1] * y, m[3][2] * z, m[3][3]
-	);
-}
-
-// get result of vector * matrix multiplication
-void mat4x4_mul_vec4(LXtVector4& result, const LXtMatrix4 m, const LXtVector4 v)
-{
-	for (int i = 0; i < 4; i++)
+	void setUV(LXtPointID point_id, const LXtFVector2 texcoords)
 	{
-		result[i] = LXx_V4DOT(m[i], v);
+		check(m_Polygon.SetMapValue(point_id, m_VMapId, texcoords));
 	}
-}
-
-void islandSolutionToMatrix(const UvpIslandPackSolutionT& islandSolution, CLxMatrix4& mat)
-{	// Set matrix used to transform UVs of the given island in order to apply
-	// a packing result	
-	mat.setToIdentity();
-
-	// Move the uv island and apply scale in xy, 
-	translate_in_place(mat, islandSolution.m_PostScaleOffset[0], islandSolution.m_PostScaleOffset[1], 0.0);
-	scale_aniso(mat, 1.0 / islandSolution.m_Scale, 1.0 / islandSolution.m_Scale, 1.0);
 
-	// Move the islands again, likely to compensate for scaling,
-	translate_in_place(mat, islandSolution.m_Offset[0], islandSolution.m_Offset[1], 0.0);
+	const char* polygonTag(LXtID4 type)
+	{
+		const char* tag = nullptr;
+		if (LXx_FAIL(m_Polygon.Tag(type, &tag)))
+			return nullptr;
+		return tag;
+	}
+};
 
-	// Move the islands to prepare for rotation,
-	translate_in_place(mat, islandSolution.m_Pivot[0], islandSolution.m_Pivot[1], 0.0);
+// Progress callback for gatherLayer and writeLayer, advances the monitor by
+// ticks steps over total polygons. The abort is remembered so the caller can
+// check it once it's done with the layer scan.
+class MonitorProgressT
+{
+	CLxUser_Monitor& m_Monitor;
+	unsigned m_Ticks;
+	double m_TicksPerPolygon;
+	double m_Done = 0.0;
+	unsigned m_Stepped = 0;
 
-	// Apply the rotation
-	CLxVector z = { 0, 0, islandSolution.m_Angle };
-	mat = mat * CLxMatrix4(z, LXi_ROTORD_XYZ);
+public:
+	bool m_Aborted = false;
 
-	// Move the islands back after rotation,
-	translate_in_place(mat, -islandSolution.m_Pivot[0], -islandSolution.m_Pivot[1], 0.0);
+	MonitorProgressT(CLxUser_Monitor& monitor, unsigned ticks, unsigned total) :
+		m_Monitor(monitor), m_Ticks(ticks), m_TicksPerPolygon(total > 0 ? (double)ticks / total : 0.0)
+	{}
 
-	scale_aniso(mat, islandSolution.m_PreScale, islandSolution.m_PreScale, 1.0);
-}
+	bool operator()(unsigned polygons)
+	{
+		m_Done += polygons * m_TicksPerPolygon;
+		unsigned step = std::min((unsigned)m_Done, m_Ticks) - m_Stepped;
+		m_Stepped += step;
 
-// |======================================================================|
-// | UV Packmaster related stuff should now be implemented, below is Modo |
-// |======================================================================|
+		// Step even with no ticks to take, it also polls for the user aborting
+		m_Aborted |= m_Monitor.Step(step);
+		return m_Aborted;
+	}
 
-#define SRVNAME_COMMAND	"uvp.pack" // Define for our command name,
+	// Take the ticks left over, from layers that were skipped
+	void finish()
+	{
+		m_Monitor.Step(m_Ticks - m_Stepped);
+		m_Stepped = m_Ticks;
+	}
+};
 
-class UVMapVisitor : public CLxImpl_AbstractVisitor
+// Ways of grouping islands for the group argument,
+enum GroupModeT
 {
-	CLxUser_MeshMap* vmap;
-	std::set<std::string> names;
+	GROUP_NONE = 0,
+	GROUP_MATERIAL,
+	GROUP_PART,
+	GROUP_SELECTION_SET
+};
 
-	virtual LxResult Evaluate()
-	{
-		const char* mapName;
-		if (LXx_OK(vmap->Name(&mapName))) {
-			names.insert(std::string(mapName));
-		}
-		return LXe_OK;
-	}
+static LXtTextValueHint hint_groupMode[] = {
+	{ GROUP_NONE, "none" },
+	{ GROUP_MATERIAL, "material" },
+	{ GROUP_PART, "part" },
+	{ GROUP_SELECTION_SET, "selectionSet" },
+	{ -1, NULL }
+};
 
-public:
-	UVMapVisitor(CLxUser_MeshMap* vmap) { this->vmap = vmap; }
-	std::set<std::string> GetNames() { return names; }
-	void ClearNames() { names.clear(); }
+// Sweep metrics for the sweepMetric argument, see SweepMetricT,
+static LXtTextValueHint hint_sweepMetric[] = {
+	{ SWEEP_COVERAGE, "coverage" },
+	{ SWEEP_SCALE, "scale" },
+	{ -1, NULL }
 };
 
 class CCommand : public CLxBasicCommand
@@ -295,6 +236,10 @@ public:
 	LxResult cmd_Query(unsigned int index, ILxUnknownID value_array) LXx_OVERRIDE;
 
 	void cmd_error(LxResult rc, const char* message);
+	void checkResult(UVP_ERRORCODE result);
+	void runOperations(std::vector<UvpOperationInputT>& inputs, std::vector<std::unique_ptr<UvpOpExecutorT>>& executors, CLxUser_Monitor& monitor, unsigned ticks, std::vector<UVP_ERRORCODE>* results = nullptr);
+	void packSweep(const UvpOperationInputT& baseInput, int count, int metric, const std::vector<UvFaceT>& faces, const std::vector<UvVertT>& verts, bool debugMode, CLxUser_Monitor& monitor, std::vector<LXtFVector2>& solved_texcoords);
+	void packPartitions(const UvpOperationInputT& baseInput, const UvPartitionT& partition, bool debugMode, CLxUser_Monitor& monitor, std::vector<LXtFVector2>& solved_texcoords);
 	LxResult atrui_UIHints(unsigned index, ILxUnknownID hints) LXx_OVERRIDE;
 	bool selectedPolygons();
 };
@@ -318,6 +263,29 @@ CCommand::CCommand()
 
 	dyna_Add("texture", LXsTYPE_VERTMAPNAME);
 	dyna_SetFlags(8, LXfCMDARG_QUERY);
+
+	dyna_Add("instanceIslands", LXsTYPE_BOOLEAN);
+	dyna_SetFlags(9, LXfCMDARG_OPTIONAL);
+
+	dyna_Add("group", LXsTYPE_INTEGER);
+	dyna_SetFlags(10, LXfCMDARG_OPTIONAL);
+	dyna_SetHint(10, hint_groupMode);
+
+	dyna_Add("capture", LXsTYPE_FILEPATH);
+	dyna_SetFlags(11, LXfCMDARG_OPTIONAL);
+
+	dyna_Add("sweep", LXsTYPE_INTEGER);
+	dyna_SetFlags(12, LXfCMDARG_OPTIONAL);
+
+	dyna_Add("sweepMetric", LXsTYPE_INTEGER);
+	dyna_SetFlags(13, LXfCMDARG_OPTIONAL);
+	dyna_SetHint(13, hint_sweepMetric);
+
+	dyna_Add("staticProxies", LXsTYPE_BOOLEAN);
+	dyna_SetFlags(14, LXfCMDARG_OPTIONAL);
+
+	dyna_Add("hierarchical", LXsTYPE_BOOLEAN);
+	dyna_SetFlags(15, LXfCMDARG_OPTIONAL);
 }
 
 // Set default values for the command dialog
@@ -421,63 +389,19 @@ bool CCommand::basic_Enable(CLxUser_Message& msg)
 
 void CCommand::basic_Execute(unsigned flags)
 {
-	UvpOperationInputT uvpInput;
-
-	// Set some parameters by default
-	// documentation: https://uvpackmaster.com/sdkdoc/70-packer-operations/20-pack/
-	uvpInput.m_pDeviceId = "cpu";
-	uvpInput.m_Opcode = UVP_OPCODE::PACK;
-
-	// When stretch is set to true, the packer will scale islands during packing.
-	// If UV islands cant fit into the packing box, the NO_SPACE code 
-	// will be returned by the operation.
-	bool stretch = dyna_Bool(0, true);
-
-	// if allow stretch == true, set fixed scale false
-	uvpInput.m_FixedScale = !(bool)stretch;
+	// Read the pack settings, see applyPackSettings for what each of them does
+	UvpackitSettingsT settings;
+	defaultPackSettings(settings);
+	settings.stretch = dyna_Bool(0, settings.stretch != 0);
+	settings.orient = dyna_Bool(1, settings.orient != 0);
+	settings.margin = dyna_Float(2, settings.margin);
+	settings.pixelMargin = dyna_Float(3, settings.pixelMargin);
+	settings.pixelPadding = dyna_Float(4, settings.pixelPadding);
+	settings.pixelMarginTextureSize = dyna_Int(5, settings.pixelMarginTextureSize);
+	settings.normalizeIslands = dyna_Bool(6, settings.normalizeIslands != 0);
 
-	// If orient is false, do not allow packer to rotate the islands.
-	bool orient = dyna_Bool(1, true);
-	if (orient == 0)
-	{
-		uvpInput.m_RotationStep = 0;
-		uvpInput.m_PrerotDisable = true;
-	}
-
-	// Determines the distance between islands after packing. The margin
-	// distance is scaled by a certain factor after packing is done, that is
-	// why the margin specified by this parameter is not exactly preserved.
-	float margin = dyna_Float(2, 0.003);
-
-	// Determines the distance between UV islands in pixels of the texture. 
-	// A margin defined using this parameter is exact (in contrast to the 
-	// m_Margin member). This parameter is only used if its value is greater
-	// than 0 (in such a case the m_Margin option is ignored and this parameter
-	// is used to determine distance between UV islands).
-	float pixelMargin = dyna_Float(3, 0.0);
-
-	// Determines the distance in pixels between UV islands and the packing
-	// box border. This option is only used if m_PixelMargin is enabled. 
-	// Setting m_PixelPadding to 0 means the feature will be ignored and pixel
-	// padding will be equal to the half of m_PixelMargin.
-	float pixelPadding = dyna_Float(4, 0.0);
-
-	// Specifies the size of the texture the packed UV map will be used with. 
-	// It allows proper application of the m_PixelMargin/ m_PixelPadding 
-	// values during the packing process.
-	int pixelMarginTextureSize = dyna_Int(5, 2048);
-
-	// If user set the pixel margin, margin will be ignored.
-	uvpInput.m_Margin = margin;
-
-	uvpInput.m_PixelMargin = pixelMargin;
-	uvpInput.m_PixelPadding = pixelPadding;
-	uvpInput.m_PixelMarginTextureSize = pixelMarginTextureSize;
-
-	// If set to true, the packer will automatically scale UV islands 
-	// before packing so that the average texel density is the same 
-	// for every island.
-	uvpInput.m_NormalizeIslands = dyna_Bool(6, false);
+	UvpOperationInputT uvpInput;
+	applyPackSettings(settings, uvpInput);
 
 	// Optionally, render invalid UVs to better show users how to satisfy the packer.
 	if(dyna_IsSet(7))
@@ -498,8 +422,6 @@ void CCommand::basic_Execute(unsigned flags)
 	bool debugMode = false;
 	#endif
 
-	UvpOpExecutorT opExecutor(debugMode);
-
 	CLxUser_StdDialogService dialog_service;
 	CLxUser_LayerService layer_service;
 	CLxUser_LayerScan scan;
@@ -510,23 +432,8 @@ void CCommand::basic_Execute(unsigned flags)
 	CLxUser_Polygon polygon;
 	CLxUser_MeshMap vmap;
 
-	LXtFVector2 texcoords;
-	LXtFVector position;
-
-	// vectors for the data,
-	std::unordered_map<UvVertT, int, UvVertHashT, UvVertEqualT> uv_map;  // Using a map only to check we don't add duplicate uv coords
-
-	// Containers to transfer the data to the uv packer later.
-	std::vector<UvVertT> m_VertArray;
-	std::vector<UvFaceT> m_FaceArray;
-
-	// UVP expects face id's as integer, while Modo have a typedef that can be cast to unsigned
-	// and I don't want to bother with converting
-	int uvp_face_index = 0;
-
-	// Lookup tables to match Modo's IDs with whatever we tell UVP
-	std::unordered_map<LXtPolygonID, int> polygon_map;
-	std::unordered_map<int, LXtPointID> point_map;
+	// Uv data gathered from all layers, see uvp_stages.hpp
+	UvGatherT gather;
 
 	// Create the flag to test accessors for selection,
 	CLxUser_MeshService mesh_service;
@@ -537,14 +444,70 @@ void CCommand::basic_Execute(unsigned flags)
 	unsigned hidden;
 	check(mesh_service.ModeCompose(LXsMARK_HIDE, NULL, &hidden));
 
-	bool pack_to_others = false;
+	// Optionally pack the islands in groups by polygon tag, each group on its own
+	int group_mode = dyna_Int(10, GROUP_NONE);
+	switch (group_mode) {
+	case GROUP_MATERIAL:
+		gather.m_GroupTag = LXi_PTAG_MATR;
+		break;
+	case GROUP_PART:
+		gather.m_GroupTag = LXi_PTAG_PART;
+		break;
+	case GROUP_SELECTION_SET:
+		gather.m_GroupTag = LXi_PTAG_PICK;
+		break;
+	default:
+		group_mode = GROUP_NONE;
+	}
+
+	// Optionally write the pack input to a capture file, to replay it outside
+	// of Modo. The time spent in each stage is stored with it.
+	std::string capture_path;
+	if (dyna_IsSet(11))
+		dyna_String(11, capture_path);
+
+	UvpCaptureTimingT timing;
+	auto stage_start = std::chrono::steady_clock::now();
+	auto stage_ms = [&stage_start]()
+	{
+		auto now = std::chrono::steady_clock::now();
+		double ms = std::chrono::duration<double, std::milli>(now - stage_start).count();
+		stage_start = now;
+		return ms;
+	};
+
+	// Initialize a progress bar for the user, covering gather and write-back
+	// with 100 steps each and the packing with 200 steps in between.
+	CLxUser_Monitor monitor;
+	dialog_service.MonitorAllocate("Packing", monitor);
+	monitor.Init(400);
 
 	// Iterate over all selected meshes,
 	CLxUser_LayerScan selected_layers;
 	unsigned selected_layers_count;
 	check(layer_service.ScanAllocate(LXf_LAYERSCAN_ACTIVE | LXf_LAYERSCAN_MARKPOLYS, selected_layers));
 	check(selected_layers.Count(&selected_layers_count));
+
+	// Count the polygons up front to spread the progress over the layers, and
+	// keep the item names to report polygons that fail validation by.
+	unsigned gather_polygon_count = 0;
+	CLxUser_Item item;
 	for (unsigned layer_index = 0; layer_index < selected_layers_count; layer_index++)
+	{
+		unsigned count = 0;
+		check(selected_layers.BaseMeshByIndex(layer_index, mesh));
+		mesh.PolygonCount(&count);
+		gather_polygon_count += count;
+
+		std::string name;
+		if (!selected_layers.ItemByIndex(layer_index, item) || !item.GetUniqueName(name))
+			name = "layer " + std::to_string(layer_index);
+		gather.m_LayerNames.push_back(name);
+	}
+
+	MonitorProgressT gather_progress(monitor, 100, gather_polygon_count);
+	bool unmapped = false;
+	for (unsigned layer_index = 0; layer_index < selected_layers_count && !unmapped && !gather_progress.m_Aborted; layer_index++)
 	{
 		// Get mesh,
 		check(selected_layers.BaseMeshByIndex(layer_index, mesh));
@@ -559,202 +522,571 @@ void CCommand::basic_Execute(unsigned flags)
 		if (uv_lookup != LXe_OK)
 			continue;
 
-		LXtMeshMapID vmap_id = vmap.ID();
-
-		// For each polygon, get uv values for uvp
-		unsigned polygon_count;
-		mesh.PolygonCount(&polygon_count);
-		for (unsigned polygon_index = 0; polygon_index < polygon_count; polygon_index++)
-		{
-			// Change the currently active polygon and get it's ID
-			polygon.SelectByIndex(polygon_index);
-			LXtPolygonID polygon_id = polygon.ID();
-
-			// Skip hidden polygons,
-			CLxResult polygon_hidden = polygon.TestMarks(hidden);
-			if (polygon_hidden.isTrue())
-				continue;
-
-			// Store the Polygon ID so we can access and set the 
-			std::pair<LXtPolygonID, int> polygon_id_lookup(polygon_id, uvp_face_index);
-			polygon_map.insert(polygon_id_lookup);
-
-			// Get the number of vertices for this polygon,
-			unsigned vertex_count;
-			polygon.VertexCount(&vertex_count);
-
-			// Check if the polygon is selected
-			CLxResult polygon_selected = polygon.TestMarks(mode);
-
-			// Create the UVP Face, the counter uvp_polygon_id will act as the ID that we have mapped to Modo's IDs
-			// https://uvpackmaster.com/sdkdoc/10-classes/50-uvfacet/
-			m_FaceArray.emplace_back(uvp_face_index);
-			UvFaceT& face = m_FaceArray.back();
-			if (polygon_selected.isTrue()) {
-				face.m_InputFlags = static_cast<int>(uvpcore::UVP_FACE_INPUT_FLAGS::SELECTED);
-			} else {
-				pack_to_others = true;
-				face.m_InputFlags = 0;
-			}
-			face.m_Verts.reserve((SizeT)vertex_count);
-
-			// For each face vertex, get the texcoord values
-			for (unsigned vertex_index = 0; vertex_index < vertex_count; vertex_index++)
-			{
-				LXtPointID point_id;
-				polygon.VertexByIndex(vertex_index, &point_id);
-
-				unsigned point_index;
-				point.Index(&point_index);
-
-				// Get the UV coordinates for polygon vertex
-				CLxResult uv_result = polygon.MapEvaluate(vmap_id, point_id, texcoords);
-				if (uv_result != LXe_OK)
-					cmd_error(LXe_FAILED, "unmappedUV");
-									
-				// And the positional data
-				point.Select(point_id);
-				point.Pos(position);
-
-				// Create vertex and copy values for uvp, comments below are from docs
-				// https://uvpackmaster.com/sdkdoc/10-classes/40-uvvertt/
-				UvVertT uvp_vertex;
-
-				// UV coordinates of the given UV vertex. This field must always be 
-				// initialized by the application.
-				uvp_vertex.m_UvCoords[0] = texcoords[0];
-				uvp_vertex.m_UvCoords[1] = texcoords[1];
-
-				// An integer value which is internally ignored by the packer, so the 
-				// application may initialize it according to its needs. In particular 
-				// this field might be used when building m_pVertArray in order to 
-				// distinguish two UV vertices which have the same UV coordinates, but 
-				// correspond to two different 3D vertices. Check the Sample application
-				// code for a usage example - it initializes the m_ControlId field with 
-				// an index of the corresponding 3d vertex in order to avoid duplicated 
-				// vertices in a UV face.
-				uvp_vertex.m_ControlId = reinterpret_cast<int>(point_id);
-
-				// 3d coordinates of the 3d vertex corresponding to the given UV vertex. 
-				// Currently this field is only used when m_NormalizeIslands parameter
-				// is set to true. Otherwise it is ignored by the packer, hence it doesnt
-				// have to be initialized by the application.
-				uvp_vertex.m_Vert3dCoords[0] = position[0];
-				uvp_vertex.m_Vert3dCoords[1] = position[1];
-				uvp_vertex.m_Vert3dCoords[2] = position[2];
-
-				// Check for duplicate entries, as we iterate over each polygon they are likely to have vertices which
-				// have same uv and positional values.
-				auto iterator = uv_map.find(uvp_vertex);
-				size_t uvp_vert_index;
-				if (iterator == uv_map.end()) 
-				{
-					uvp_vert_index = m_VertArray.size(); // Get the size to update which index we're on.
-					uv_map[uvp_vertex] = uvp_vert_index; // Add the pair uvp_vertex, uvp_vert_index to the uv_map
-					m_VertArray.emplace_back(uvp_vertex);// Add the current UvVertT to the back of the array
-					point_map[uvp_vert_index] = point_id;// Store so we can get the point id for a uv vertex.
-				}
-				else 
-				{	// For the found pair, get the second element, which is the previously stored index.
-					uvp_vert_index = (*iterator).second;
-				}
-
-				face.m_Verts.pushBack(uvp_vert_index);
-			}
-			uvp_face_index++;
-		}
+		ModoMeshAccessT access(mesh, polygon, point, vmap.ID(), mode, hidden);
+		unmapped = !gatherLayer(access, layer_index, gather, gather_progress);
 	}
 	selected_layers.Apply(); // If we don't apply, next layerscan will fail it seem,
 	selected_layers.clear();
 	selected_layers = NULL;
 
+	if (unmapped || gather_progress.m_Aborted)
+	{
+		dialog_service.MonitorRelease();
+		if (gather_progress.m_Aborted)
+			cmd_error(LXe_ABORT, "uvpAborted");
+		cmd_error(LXe_FAILED, "unmappedUV");
+	}
+	gather_progress.finish();
+
 	// If users are in Polygon mode, and have polygons selected, assume they want to pack
 	// the selected polygons into pre-existing packing solution.
-	uvpInput.m_PackToOthers = pack_to_others;
+	uvpInput.m_PackToOthers = gather.m_PackToOthers;
 
 	// If m_ProcessedUnselected is set to false (the default state), then the 
 	// SELECTED flag of the UV faces is ignored by the packer and every island
 	// is considered as selected (the application doesnt have to set this flag
 	// in such a case).
-	uvpInput.m_ProcessUnselected = pack_to_others; // Required so we check unselected
+	uvpInput.m_ProcessUnselected = gather.m_PackToOthers; // Required so we check unselected
+
+	timing.m_GatherMs = stage_ms();
+
+	// Validate the gathered data before packing, bad input would otherwise only
+	// show up as INVALID_ISLANDS or a generic failure once UVP is done.
+	UvDataIssuesT issues = validateUvData(gather.m_VertArray, gather.m_FaceArray);
+	timing.m_ValidateMs = stage_ms();
+	if (!issues.empty())
+	{
+		// Name at most this many polygons per check, to keep the log readable,
+		const size_t maxReported = 32;
+
+		auto report = [&](const std::vector<int>& faces, const char* reason)
+		{
+			if (faces.empty())
+				return;
+
+			std::string message = std::to_string(faces.size()) + " polygon(s) with " + reason + ":";
+			for (size_t i = 0; i < faces.size() && i < maxReported; i++)
+			{
+				const auto& origin = gather.m_FaceOrigin[faces[i]];
+				message += " " + gather.m_LayerNames[origin.first] + " poly " + std::to_string(origin.second) + ",";
+			}
+			message.pop_back();
+			if (faces.size() > maxReported)
+				message += " ...";
+
+			logMessage(LXe_WARNING, message);
+		};
+
+		report(issues.m_BadIndex, "invalid vertex indices");
+		report(issues.m_NonFinite, "NaN or infinite coordinates");
+		report(issues.m_DuplicateCorner, "duplicate corners");
+		report(issues.m_Degenerate, "degenerate uvs");
+
+		dialog_service.MonitorRelease();
+		cmd_error(LXe_FAILED, "invalidInput");
+	}
+
+	// Optionally send only one of each group of identical islands to UVP, the
+	// other islands in the group are stacked on top of it when applying the
+	// solution. Saves UVP a lot of work on kitbash and modular assets.
+	bool instance_islands = dyna_Bool(9, false);
+	UvInstancesT instances;
+	if (instance_islands)
+	{
+		instanceIslands(gather, uvpInput.m_NormalizeIslands, instances);
+		logMessage(LXe_INFO, "Instanced " + std::to_string(instances.m_InstanceCount) + " duplicate UV island(s)");
+	}
+
+	// Optionally send the static islands of a pack-to-others pack as convex
+	// hulls, much cheaper for UVP when packing a small selection on a dense
+	// mesh. Only the selected islands are written back either way.
+	bool static_proxies = dyna_Bool(14, false) && uvpInput.m_PackToOthers;
+	UvProxiesT proxies;
+	if (static_proxies)
+	{
+		proxyStaticIslands(gather.m_VertArray, instance_islands ? instances.m_FaceArray : gather.m_FaceArray, proxies);
+		logMessage(LXe_INFO, "Replaced " + std::to_string(proxies.m_ReplacedCount) + " static polygon(s) with " + std::to_string(proxies.m_ProxyCount) + " proxy polygon(s)");
+	}
+	const std::vector<UvFaceT>& kept_faces = static_proxies ? proxies.m_FaceArray : instance_islands ? instances.m_FaceArray : gather.m_FaceArray;
+
+	// Instancing and proxies leave the vertices of the faces they drop unused,
+	// so only the vertices of the kept faces are sent to UVP. The solved uvs
+	// are copied back to the gathered vertices after packing.
+	const bool compact = instance_islands || static_proxies;
+	UvCompactT compacted;
+	if (compact)
+		compactVerts(kept_faces, gather.m_VertArray, compacted);
+	std::vector<UvFaceT>& pack_faces = compact ? compacted.m_FaceArray : gather.m_FaceArray;
+	std::vector<UvVertT>& pack_verts = compact ? compacted.m_VertArray : gather.m_VertArray;
 
 	// Transfer the collected data to uvp input
-	if (m_FaceArray.size() > 0)
+	if (pack_faces.size() > 0)
 	{
-		uvpInput.m_UvData.m_FaceCount = m_FaceArray.size();
-		uvpInput.m_UvData.m_pFaceArray = m_FaceArray.data();
+		uvpInput.m_UvData.m_FaceCount = pack_faces.size();
+		uvpInput.m_UvData.m_pFaceArray = pack_faces.data();
 	}
-	if (m_VertArray.size() > 0)
+	if (pack_verts.size() > 0)
 	{
-		uvpInput.m_UvData.m_VertCount = m_VertArray.size();
-		uvpInput.m_UvData.m_pVertArray = m_VertArray.data();
+		uvpInput.m_UvData.m_VertCount = pack_verts.size();
+		uvpInput.m_UvData.m_pVertArray = pack_verts.data();
 	}
 
-	// Initialize a progress bar for the user
-	CLxUser_Monitor monitor;
-	dialog_service.MonitorAllocate("Packing", monitor);
-	monitor.Init(100);
+	std::vector<LXtFVector2> solved_texcoords;
+	initTexcoords(gather.m_VertArray, solved_texcoords);
+	std::vector<LXtFVector2> compact_texcoords;
+	if (compact)
+		initTexcoords(pack_verts, compact_texcoords);
+	std::vector<LXtFVector2>& pack_texcoords = compact ? compact_texcoords : solved_texcoords;
+
+	// Optionally pack several variants of the settings at once and keep the
+	// best, only supported for ungrouped packs.
+	int sweep_count = dyna_Int(12, 0);
+	int sweep_metric = dyna_Int(13, SWEEP_COVERAGE);
+	if (sweep_count > 1 && group_mode != GROUP_NONE)
+	{
+		logMessage(LXe_WARNING, "Parameter sweeps are not supported for grouped packs, packing once");
+		sweep_count = 0;
+	}
+
+	UvpCaptureModeT capture_mode;
+	if (sweep_count > 1)
+	{
+		capture_mode.m_SweepCount = sweep_count;
+		capture_mode.m_SweepMetric = sweep_metric;
+	}
+
+	// Pack huge numbers of islands hierarchically, in clusters of neighbouring
+	// islands packed concurrently, which are then packed together as boxes, see
+	// packPartitions. Automatic from UV_HIERARCHY_ISLAND_COUNT selected islands
+	// unless the hierarchical argument turns it on or off.
+	const bool hierarchical_forced = dyna_IsSet(15);
+	const bool hierarchical = dyna_Bool(15, false);
+	UvPartitionT clusters;
+	if (hierarchical && (sweep_count > 1 || group_mode != GROUP_NONE))
+	{
+		logMessage(LXe_WARNING, "Hierarchical packing is not supported for grouped packs or parameter sweeps, packing without it");
+	}
+	else if (sweep_count <= 1 && group_mode == GROUP_NONE &&
+		(hierarchical || (!hierarchical_forced && pack_faces.size() >= UV_HIERARCHY_ISLAND_COUNT)))
+	{
+		std::vector<std::vector<int>> islands = findIslands(pack_verts, pack_faces);
+		size_t island_count = countSelectedIslands(islands, pack_faces);
+
+		// At least one cluster per hardware thread, as long as the clusters
+		// don't get so small that packing them loses coverage.
+		size_t cluster_count = std::max<size_t>(std::thread::hardware_concurrency(), (island_count + UV_CLUSTER_ISLAND_COUNT - 1) / UV_CLUSTER_ISLAND_COUNT);
+		cluster_count = std::min(cluster_count, island_count / (UV_CLUSTER_ISLAND_COUNT / 4));
+
+		// A single cluster would only add the box pass to a single pack.
+		if (hierarchical_forced && cluster_count < 2)
+			logMessage(LXe_INFO, "Too few islands to pack hierarchically, packing " + std::to_string(island_count) + " island(s) at once");
+		else if (hierarchical_forced || island_count >= UV_HIERARCHY_ISLAND_COUNT)
+		{
+			clusterIslands(pack_verts, pack_faces, islands, (int)cluster_count, clusters);
+			logMessage(LXe_INFO, "Packing " + std::to_string(island_count) + " island(s) hierarchically in " + std::to_string(clusters.m_Parts.size()) + " cluster(s)");
+			capture_mode.m_ClusterCount = (int32_t)cluster_count;
+		}
+	}
+
+	// Group of every face sent to UVP, instancing and proxies drop and
+	// renumber faces.
+	std::vector<int> face_group;
+	if (group_mode != GROUP_NONE)
+	{
+		face_group.resize(pack_faces.size());
+		for (size_t i = 0; i < pack_faces.size(); i++)
+		{
+			int source = static_proxies ? proxies.m_FaceSource[i] : (int)i;
+			face_group[i] = gather.m_FaceGroup[instance_islands ? instances.m_FaceSource[source] : source];
+		}
+		capture_mode.m_GroupMode = group_mode;
+		capture_mode.m_GroupCount = (int32_t)gather.m_GroupNames.size();
+	}
+
+	// Capture before packing so packs that fail or hang are captured too,
+	// along with how the pack is split up so it is replayed the same way.
+	if (!capture_path.empty() && !writeCapture(capture_path, uvpInput, capture_mode, face_group, timing))
+		logMessage(LXe_WARNING, "Could not write capture file " + capture_path);
+
+	if (sweep_count > 1)
+	{
+		packSweep(uvpInput, sweep_count, sweep_metric, pack_faces, pack_verts, debugMode, monitor, pack_texcoords);
+	}
+	else if (!clusters.m_Parts.empty())
+	{
+		packPartitions(uvpInput, clusters, debugMode, monitor, pack_texcoords);
+	}
+	else if (group_mode == GROUP_NONE)
+	{
+		std::vector<UvpOperationInputT> inputs(1, uvpInput);
+		std::vector<std::unique_ptr<UvpOpExecutorT>> executors;
+		executors.emplace_back(new UvpOpExecutorT(debugMode));
+
+		runOperations(inputs, executors, monitor, 200);
+
+		// Apply the transforms for the packing solution,
+		applyExecutorSolution(*executors[0], pack_faces, pack_verts, pack_texcoords);
+	}
+	else
+	{
+		UvPartitionT partition;
+		partitionGroups(pack_verts, pack_faces, face_group, (int)gather.m_GroupNames.size(), partition);
+		logMessage(LXe_INFO, "Packing " + std::to_string(partition.m_Parts.size()) + " group(s)");
+
+		// Every island is static, say when all selected polygons are hidden,
+		if (partition.m_Parts.empty())
+		{
+			dialog_service.MonitorRelease();
+			cmd_error(LXe_FAILED, "noIslands");
+		}
+
+		packPartitions(uvpInput, partition, debugMode, monitor, pack_texcoords);
+	}
+
+	if (compact)
+		scatterTexcoords(compacted, compact_texcoords, solved_texcoords);
 
-	// Run the execute method in another thread to not block main thread,
+	if (instance_islands)
+		applyInstances(instances, solved_texcoords);
+
+	timing.m_PackMs = stage_ms();
+
+	CLxUser_LayerScan editable_layers;
+	check(layer_service.ScanAllocate(LXf_LAYERSCAN_EDIT, editable_layers));
+	unsigned editable_layer_count;
+	editable_layers.Count(&editable_layer_count);
+
+	unsigned write_polygon_count = 0;
+	for (unsigned layer_index = 0; layer_index < editable_layer_count; layer_index++)
+	{
+		unsigned count = 0;
+		check(editable_layers.EditMeshByIndex(layer_index, mesh));
+		mesh.PolygonCount(&count);
+		write_polygon_count += count;
+	}
+
+	// Write the uvs of the first layer_count layers, stopping early if progress
+	// aborts. Returns the number of layers touched.
+	auto write_layers = [&](unsigned layer_count, const std::vector<LXtFVector2>& texcoords, MonitorProgressT* progress)
+	{
+		unsigned layer_index = 0;
+		bool finished = true;
+		for (; layer_index < layer_count && finished; layer_index++)
+		{
+			check(editable_layers.EditMeshByIndex(layer_index, mesh));
+			check(polygon.fromMesh(mesh));
+			check(vmap.fromMesh(mesh));
+
+			// Get the vmap, if not successful, skip layer
+			CLxResult uv_lookup = vmap.SelectByName(LXi_VMAP_TEXTUREUV, map_name.c_str());
+			if (uv_lookup.fail())
+				continue;
+
+			ModoMeshAccessT access(mesh, polygon, point, vmap.ID(), mode, hidden);
+			if (progress)
+				finished = writeLayer(access, gather, texcoords, *progress);
+			else
+				writeLayer(access, gather, texcoords);
+
+			// If a mesh is accessed for write, any edits made have to be signalled back to the mesh.
+			mesh.SetMeshEdits(LXf_MESHEDIT_MAP_UV);
+			// The mesh change bit mask should be set for all edited meshes before changes are applied.
+			editable_layers.SetMeshChange(layer_index, LXf_MESHEDIT_MAP_UV);
+			// performs the mesh edits, but does not terminate the scan.
+			editable_layers.Update();
+		}
+		return layer_index;
+	};
+
+	MonitorProgressT write_progress(monitor, 100, write_polygon_count);
+	unsigned written_layers = write_layers(editable_layer_count, solved_texcoords, &write_progress);
+
+	// If the user aborted half way, put the gathered uvs back on every layer
+	// touched so far, so a cancel leaves the meshes as they were.
+	if (write_progress.m_Aborted)
+	{
+		std::vector<LXtFVector2> original_texcoords;
+		initTexcoords(gather.m_VertArray, original_texcoords);
+		write_layers(written_layers, original_texcoords, nullptr);
+	}
+	editable_layers.Apply();
+
+	// Release progress bar.
+	dialog_service.MonitorRelease();
+
+	if (write_progress.m_Aborted)
+		cmd_error(LXe_ABORT, "uvpAborted");
+
+	timing.m_WriteMs = stage_ms();
+	if (!capture_path.empty())
+		updateCaptureTiming(capture_path, timing);
+}
+
+// Run the operations concurrently, each on its own executor, at most one per
+// hardware thread at a time. The monitor is advanced by ticks steps following
+// the average progress of the operations. If any of them fails the monitor
+// is released and the command fails. If results is given, it receives the
+// result of every operation and the command only fails on cancel or if no
+// operation succeeded.
+void CCommand::runOperations(std::vector<UvpOperationInputT>& inputs, std::vector<std::unique_ptr<UvpOpExecutorT>>& executors, CLxUser_Monitor& monitor, unsigned ticks, std::vector<UVP_ERRORCODE>* operation_results)
+{
+	const int count = (int)inputs.size();
+
+	// Nothing to wait for, and the progress average needs operations,
+	if (count == 0)
+	{
+		monitor.Step(ticks);
+		if (operation_results)
+			operation_results->clear();
+		return;
+	}
+
+	std::vector<UVP_ERRORCODE> results(count, UVP_ERRORCODE::GENERAL_ERROR);
+	std::vector<std::string> exceptions(count);
+	std::atomic_int next = 0;
+	std::atomic_bool aborted = false;
+
+	// Each worker keeps taking the next operation until none are left,
+	auto worker = [&]()
+	{
+		for (int i = next++; i < count; i = next++)
+		{
+			if (aborted)
+			{
+				results[i] = UVP_ERRORCODE::CANCELLED;
+				executors[i]->packing_progress = 100;
+				continue;
+			}
+
+			try
+			{
+				results[i] = executors[i]->execute(inputs[i]);
+			} // Should only raise an exception if we're running in debug
+			catch (const std::exception & ex) {
+				exceptions[i] = ex.what();
+				executors[i]->packing_progress = 100;
+			}
+		}
+	};
+
+	// Run the workers in other threads to not block main thread,
 	// see execute method for more details...
-	auto future = std::async(std::bind(&UvpOpExecutorT::execute, &opExecutor, uvpInput));
+	unsigned worker_count = std::min((unsigned)count, std::max(1u, std::thread::hardware_concurrency()));
+	std::vector<std::future<void>> futures;
+	for (unsigned i = 0; i < worker_count; i++)
+		futures.push_back(std::async(std::launch::async, worker));
+
+	auto average_progress = [&]()
+	{
+		unsigned total = 0;
+		for (const auto& executor : executors)
+			total += executor->packing_progress;
+		return total * ticks / (100 * (unsigned)count);
+	};
 
 	// Keep track of progress on this thread,
 	unsigned progress = 0;
 
-	// Update every poll to see if user aborted the monitor progress, 
-	bool bUserAborted = false;
-
-	// Poll the packer instance every 50ms to check on progress,
+	// Poll the executors every 50ms to check on progress,
 	// while we keep getting progress updates.
-	while (progress < 100)
+	while (progress < ticks)
 	{
-		unsigned step = opExecutor.packing_progress - progress;
-		bUserAborted = monitor.Step(step);
+		unsigned step = average_progress() - progress;
+
+		// Update every poll to see if user aborted the monitor progress,
+		bool bUserAborted = monitor.Step(step);
 		progress += step;
 
 		if (bUserAborted)
 		{
-			opExecutor.cancel();
+			aborted = true;
+			for (const auto& executor : executors)
+				executor->cancel();
 			break;
 		}
 		std::this_thread::sleep_for(std::chrono::milliseconds(50));
 	}
 
+	// Wait for all operations to return,
+	for (auto& future : futures)
+		future.get();
+
 	// Take the monitor the final step,
-	monitor.Step(opExecutor.packing_progress - progress);
+	monitor.Step(average_progress() - progress);
+
+	// Print runtime errors to log so we can read any validation errors.
+	for (const std::string& exception : exceptions)
+		if (!exception.empty())
+			logMessage(LXe_INFO, exception);
+
+	// fail if we did not recieve any solution,
+	bool messages_found = true;
+	for (int i = 0; i < count; i++)
+	{
+		if (!executors[i]->getLastMessage(UvpMessageT::MESSAGE_CODE::ISLANDS) || !executors[i]->getLastMessage(UvpMessageT::MESSAGE_CODE::PACK_SOLUTION))
+		{
+			if (!operation_results)
+				messages_found = false;
+			else if (results[i] == UVP_ERRORCODE::SUCCESS)
+				results[i] = UVP_ERRORCODE::GENERAL_ERROR;
+		}
+	}
 
-	// Get the result code from the packer instance, hopefully joins
-	// the async thread also.
-	UVP_ERRORCODE Result = UVP_ERRORCODE::GENERAL_ERROR;
-	try
+	// Report a cancel over anything else, otherwise the first failure. With
+	// operation_results, failures only count if every operation failed.
+	UVP_ERRORCODE result = UVP_ERRORCODE::SUCCESS;
+	bool any_succeeded = false;
+	for (UVP_ERRORCODE code : results)
 	{
-		if (future.valid())
+		if (code == UVP_ERRORCODE::CANCELLED)
 		{
-			Result = future.get();
+			result = code;
+			break;
 		}
-	} // Should only raise an exception if we're running in debug
-	catch (const std::exception & ex) {
-		// Set up to create log entries,
-		CLxUser_Log log;
-		CLxUser_LogService log_service;
-		CLxUser_LogEntry entry;
+		if (result == UVP_ERRORCODE::SUCCESS)
+			result = code;
+		any_succeeded |= code == UVP_ERRORCODE::SUCCESS;
+	}
 
-		// Get the Master Log,
-		log_service.GetSubSystem(LXsLOG_LOGSYS, log);
+	if (operation_results)
+	{
+		*operation_results = results;
+		if (any_succeeded && result != UVP_ERRORCODE::CANCELLED)
+			return;
+	}
 
-		// Print the runtime error to log so we can read any validation errors.
-		log_service.NewEntry(LXe_INFO, ex.what(), entry);
+	if (result != UVP_ERRORCODE::SUCCESS || !messages_found)
+	{
+		CLxUser_StdDialogService dialog_service;
+		dialog_service.MonitorRelease();
 
-		log.AddEntry(entry);
+		checkResult(result);
+		cmd_error(LXe_FAILED, "uvpMsgNotFound");
 	}
+}
 
-	// Release progress bar.
-	dialog_service.MonitorRelease();
+// Pack each partition as its own operation, then pack the bounding boxes of the
+// packed partitions around the static islands and move every partition along
+// with its box. Between the two rounds the partitions are scaled to a shared
+// texel density, so it matches a single pack. Margins are scaled by the box
+// scale expected from the partition sizes, and come out within a few percent
+// of the asked for margins as long as the box pass scales about as expected.
+// Advances the monitor by 200 steps, 100 for each round.
+void CCommand::packPartitions(const UvpOperationInputT& baseInput, const UvPartitionT& partition, bool debugMode, CLxUser_Monitor& monitor, std::vector<LXtFVector2>& solved_texcoords)
+{
+	const size_t part_count = partition.m_Parts.size();
+	const std::vector<double> sizes = partitionSizes(partition, baseInput.m_NormalizeIslands);
+
+	// Every partition is packed on its own into the unit square,
+	std::vector<UvpOperationInputT> inputs;
+	partitionInputs(baseInput, partition, sizes, inputs);
+
+	std::vector<std::unique_ptr<UvpOpExecutorT>> executors;
+	for (size_t i = 0; i < part_count; i++)
+		executors.emplace_back(new UvpOpExecutorT(debugMode));
+
+	runOperations(inputs, executors, monitor, 100);
+
+	// solved in the partition's own vertices,
+	std::vector<std::vector<LXtFVector2>> part_texcoords(part_count);
+	for (size_t i = 0; i < part_count; i++)
+	{
+		const UvCompactT& part = partition.m_Parts[i];
+		initTexcoords(part.m_VertArray, part_texcoords[i]);
+		applyExecutorSolution(*executors[i], part.m_FaceArray, part.m_VertArray, part_texcoords[i]);
+	}
 
-	// Switch on the result and return error messages defined as a 
-	// message table in our config, see index.cfg
-	switch (Result) {
+	equalizePartitionDensity(partition, sizes, part_texcoords);
+
+	std::vector<UvVertT> box_verts;
+	std::vector<UvFaceT> box_faces;
+	partitionBoxes(partition, part_texcoords, box_verts, box_faces);
+
+	std::vector<UvpOperationInputT> box_input(1, partitionBoxInput(baseInput, partition, box_verts, box_faces));
+	std::vector<std::unique_ptr<UvpOpExecutorT>> box_executor;
+	box_executor.emplace_back(new UvpOpExecutorT(debugMode));
+	runOperations(box_input, box_executor, monitor, 100);
+
+	const UvpIslandsMessageT* pIslandsMsg = static_cast<const UvpIslandsMessageT*>(box_executor[0]->getLastMessage(UvpMessageT::MESSAGE_CODE::ISLANDS));
+	const UvpPackSolutionMessageT* pPackSolutionMsg = static_cast<const UvpPackSolutionMessageT*>(box_executor[0]->getLastMessage(UvpMessageT::MESSAGE_CODE::PACK_SOLUTION));
+	applyPartitionBoxes(*pIslandsMsg, *pPackSolutionMsg, partition, part_texcoords, solved_texcoords);
+}
+
+// Pack every variant of the settings from sweepVariants concurrently, then
+// apply the solution of the best one by sweepScore and log how each of them
+// did. The scale metric favors variants that keep the most texel density.
+// Variants that fail are reported and skipped. Advances the monitor by 200
+// steps.
+void CCommand::packSweep(const UvpOperationInputT& baseInput, int count, int metric, const std::vector<UvFaceT>& faces, const std::vector<UvVertT>& verts, bool debugMode, CLxUser_Monitor& monitor, std::vector<LXtFVector2>& solved_texcoords)
+{
+	// A larger margin can only ever cover less, so coverage sweeps keep it.
+	std::vector<UvpOperationInputT> inputs = sweepVariants(baseInput, count, metric == SWEEP_SCALE);
+	std::vector<std::unique_ptr<UvpOpExecutorT>> executors;
+	for (size_t i = 0; i < inputs.size(); i++)
+		executors.emplace_back(new UvpOpExecutorT(debugMode));
+
+	std::vector<UVP_ERRORCODE> results;
+	runOperations(inputs, executors, monitor, 200, &results);
+
+	const bool selected_only = baseInput.m_ProcessUnselected;
+	const double input_area = uvArea(faces, verts, nullptr, selected_only);
+	const char* metric_name = metric == SWEEP_SCALE ? "scale" : "coverage";
+
+	int best = -1;
+	double best_score = 0.0;
+	std::vector<LXtFVector2> variant_texcoords;
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		const UvpOperationInputT& input = inputs[i];
+		std::string message = "Sweep variant " + std::to_string(i + 1) +
+			": margin " + std::to_string(input.m_Margin) +
+			", rotation step " + std::to_string(input.m_RotationStep) +
+			", stretch " + (input.m_FixedScale ? "off" : "on") +
+			", normalize " + (input.m_NormalizeIslands ? "on" : "off");
+
+		if (results[i] != UVP_ERRORCODE::SUCCESS)
+		{
+			logMessage(LXe_INFO, message + ", failed");
+			continue;
+		}
+
+		initTexcoords(verts, variant_texcoords);
+		applyExecutorSolution(*executors[i], faces, verts, variant_texcoords);
+
+		double score = sweepScore(metric, faces, verts, variant_texcoords, selected_only, input_area);
+		logMessage(LXe_INFO, message + ", " + metric_name + " " + std::to_string(score));
+
+		if (best < 0 || score > best_score)
+		{
+			best = (int)i;
+			best_score = score;
+		}
+	}
+
+	logMessage(LXe_INFO, "Applied sweep variant " + std::to_string(best + 1));
+	applyExecutorSolution(*executors[best], faces, verts, solved_texcoords);
+
+	// Make it obvious when the uvs were packed with other settings than the
+	// command was given,
+	const UvpOperationInputT& applied = inputs[best];
+	std::string changed;
+	if (applied.m_Margin != baseInput.m_Margin)
+		changed += ", margin " + std::to_string(applied.m_Margin) + " instead of " + std::to_string(baseInput.m_Margin);
+	if (applied.m_RotationStep != baseInput.m_RotationStep)
+		changed += ", rotation step " + std::to_string(applied.m_RotationStep) + " instead of " + std::to_string(baseInput.m_RotationStep);
+	if (applied.m_FixedScale != baseInput.m_FixedScale)
+		changed += std::string(", stretch ") + (applied.m_FixedScale ? "off" : "on") + " instead of " + (baseInput.m_FixedScale ? "off" : "on");
+	if (applied.m_NormalizeIslands != baseInput.m_NormalizeIslands)
+		changed += std::string(", normalize ") + (applied.m_NormalizeIslands ? "on" : "off") + " instead of " + (baseInput.m_NormalizeIslands ? "on" : "off");
+	if (!changed.empty())
+		logMessage(LXe_WARNING, "Packed with settings that differ from the command arguments:" + changed.substr(1));
+}
+
+// Switch on the result and return error messages defined as a 
+// message table in our config, see index.cfg
+void CCommand::checkResult(UVP_ERRORCODE result)
+{
+	switch (result) {
 	case UVP_ERRORCODE::SUCCESS:
 		// All went fine, we likely don't have to report back anything
 		break;
@@ -781,108 +1113,6 @@ void CCommand::basic_Execute(unsigned flags)
 		// Default to our "generic" error
 		cmd_error(LXe_FAILED, "uvpFailed");
 	}
-
-	// fail if we did not recieve any solution,
-	if (!opExecutor.getLastMessage(UvpMessageT::MESSAGE_CODE::ISLANDS) || !opExecutor.getLastMessage(UvpMessageT::MESSAGE_CODE::PACK_SOLUTION))
-	{
-		cmd_error(LXe_FAILED, "uvpMsgNotFound");
-	}
-
-	const UvpIslandsMessageT* pIslandsMsg = static_cast<const UvpIslandsMessageT*>(opExecutor.getLastMessage(UvpMessageT::MESSAGE_CODE::ISLANDS));
-	const UvpPackSolutionMessageT* pPackSolutionMsg = static_cast<const UvpPackSolutionMessageT*>(opExecutor.getLastMessage(UvpMessageT::MESSAGE_CODE::PACK_SOLUTION));
-
-	// Copy over the values from the original input to the new texcoords
-	std::vector<LXtFVector2> solved_texcoords(m_VertArray.size());
-	for (int i = 0; i < m_VertArray.size(); i++)
-	{
-		const UvVertT& origVert = m_VertArray[i];
-		solved_texcoords[i][0] = origVert.m_UvCoords[0];
-		solved_texcoords[i][1] = origVert.m_UvCoords[1];
-	}
-	
-	// Apply the transforms for the packing solution,
-	const auto& islands = pIslandsMsg->m_Islands;
-	const auto& solutions = pPackSolutionMsg->m_IslandSolutions;
-	for (const UvpIslandPackSolutionT& islandSolution : pPackSolutionMsg->m_IslandSolutions)
-	{
-		const IdxArrayT& island = islands[islandSolution.m_IslandIdx];
-
-		// Given a solution from uvp, get 
-		CLxMatrix4 solutionMatrix;
-		islandSolutionToMatrix(islandSolution, solutionMatrix);
-
-		for (int faceId : island)
-		{
-			const UvFaceT& face = m_FaceArray[faceId];
-
-			for (int vertIdx : face.m_Verts)
-			{
-				const UvVertT& origVert = m_VertArray[vertIdx];
-				LXtVector4 input_uv = { origVert.m_UvCoords[0], origVert.m_UvCoords[1], 0.0, 1.0 };
-				LXtVector4 solved_uv;
-
-				mat4x4_mul_vec4(solved_uv, solutionMatrix, input_uv);
-
-				solved_texcoords[vertIdx][0] = solved_uv[0] / solved_uv[3];
-				solved_texcoords[vertIdx][1] = solved_uv[1] / solved_uv[3];
-			}
-		}
-	}
-
-	CLxUser_LayerScan editable_layers;
-	check(layer_service.ScanAllocate(LXf_LAYERSCAN_EDIT, editable_layers));
-	unsigned editable_layer_count;
-	editable_layers.Count(&editable_layer_count);
-	for (unsigned layer_index = 0; layer_index < editable_layer_count; layer_index++)
-	{
-		check(editable_layers.EditMeshByIndex(layer_index, mesh));
-		check(polygon.fromMesh(mesh));
-		check(vmap.fromMesh(mesh));
-
-		// Get the vmap, if not successful, skip layer
-		CLxResult uv_lookup = vmap.SelectByName(LXi_VMAP_TEXTUREUV, map_name.c_str());
-		if (uv_lookup.fail())
-			continue;
-
-		// For each polygon, set the uv for selected polygons,
-		unsigned polygon_count;
-		mesh.PolygonCount(&polygon_count);
-		for (unsigned polygon_index = 0; polygon_index < polygon_count; polygon_index++)
-		{
-			polygon.SelectByIndex(polygon_index);
-			LXtPolygonID polygon_id = polygon.ID();
-
-			// Just skip this polygon if not selected,
-			CLxResult polygon_selected = polygon.TestMarks(mode);
-			if (polygon_selected.isFalse())
-				continue;
-
-			// Find the index for the current polygon in the polygon map,
-			// the second element should hold index to solved uv face.
-			int face_index = -1;
-			auto iterator = polygon_map.find(polygon_id);
-			if (iterator != polygon_map.end())
-				face_index = iterator->second;
-
-			// For each vertex in face, set the solved uv coordinates. Duplicate checks should already been made so 
-			const UvFaceT& uv_face = m_FaceArray[face_index];
-			for (const int vert_index : uv_face.m_Verts)
-			{
-				const UvVertT& uv_vert = m_VertArray[vert_index];
-				// Find the stored point id for the uv vertex and set the map value
-				auto point_id_lookup = point_map.find(vert_index);
-				if (point_id_lookup != point_map.end())
-					check(polygon.SetMapValue((*point_id_lookup).second, vmap.ID(), solved_texcoords[vert_index]));
-			}
-		}
-		// If a mesh is accessed for write, any edits made have to be signalled back to the mesh.
-		mesh.SetMeshEdits(LXf_MESHEDIT_MAP_UV);
-		// The mesh change bit mask should be set for all edited meshes before changes are applied.
-		editable_layers.SetMeshChange(layer_index, LXf_MESHEDIT_MAP_UV);
-		// performs the mesh edits, but does not terminate the scan.
-		editable_layers.Update();
-	}
-	editable_layers.Apply();
 }
 
 // Basically attempting to do the same as CLxCommand::cmd_error
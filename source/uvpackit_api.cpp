@@ -0,0 +1,173 @@
+// C entry point for packing caller owned uv buffers, see uvpackit_api.h. Runs
+// the same stages as uvp.pack without Modo, validation, a single UVP operation
+// and applying the solution.
+
+#include <vector>
+#include <stdexcept>
+
+#include "uvpackit_api.h"
+#include "uvp_stages.hpp"
+#include "uvp_executor.hpp"
+
+void uvpackitDefaultSettings(UvpackitSettingsT* settings)
+{
+	if (settings)
+		defaultPackSettings(*settings);
+}
+
+// Does the work of uvpackitPack, which keeps exceptions from crossing the C
+// boundary.
+static UvpackitResultT packBuffers(const UvpackitSettingsT* settings, UvpackitBuffersT* buffers)
+{
+	if (!settings || !buffers || !buffers->uvs || !buffers->faceIndices || !buffers->faceSizes ||
+		buffers->vertCount < 0 || buffers->faceCount < 0 || buffers->cornerCount < 0)
+		return UVPACKIT_INVALID_ARGUMENT;
+
+	if (settings->normalizeIslands && !buffers->positions)
+		return UVPACKIT_INVALID_ARGUMENT;
+
+	// UVP only takes its own vertex and face types, so the buffers are read
+	// into those once. Nothing else is copied.
+	std::vector<UvVertT> verts(buffers->vertCount);
+	for (int i = 0; i < buffers->vertCount; i++)
+	{
+		UvVertT& vert = verts[i];
+		vert.m_UvCoords[0] = buffers->uvs[2 * i];
+		vert.m_UvCoords[1] = buffers->uvs[2 * i + 1];
+		for (int j = 0; j < 3; j++)
+			vert.m_Vert3dCoords[j] = buffers->positions ? buffers->positions[3 * i + j] : 0.0f;
+		vert.m_ControlId = i;
+	}
+
+	const int selected = static_cast<int>(uvpcore::UVP_FACE_INPUT_FLAGS::SELECTED);
+	bool pack_to_others = false;
+
+	std::vector<UvFaceT> faces;
+	faces.reserve(buffers->faceCount);
+	int corner = 0;
+	for (int i = 0; i < buffers->faceCount; i++)
+	{
+		int size = buffers->faceSizes[i];
+		if (size < 0 || size > buffers->cornerCount - corner)
+			return UVPACKIT_INVALID_ARGUMENT;
+
+		faces.emplace_back(i);
+		UvFaceT& face = faces.back();
+		if (!buffers->faceSelected || buffers->faceSelected[i])
+		{
+			face.m_InputFlags = selected;
+		}
+		else
+		{
+			face.m_InputFlags = 0;
+			pack_to_others = true;
+		}
+
+		face.m_Verts.reserve((SizeT)size);
+		for (int j = 0; j < size; j++)
+			face.m_Verts.pushBack(buffers->faceIndices[corner++]);
+	}
+	if (corner != buffers->cornerCount)
+		return UVPACKIT_INVALID_ARGUMENT;
+
+	if (!validateUvData(verts, faces).empty())
+		return UVPACKIT_INVALID_INPUT;
+
+	UvpOperationInputT uvpInput;
+	applyPackSettings(*settings, uvpInput);
+	uvpInput.m_PackToOthers = pack_to_others;
+	uvpInput.m_ProcessUnselected = pack_to_others;
+	uvpInput.m_UvData.m_FaceCount = (int)faces.size();
+	uvpInput.m_UvData.m_pFaceArray = faces.data();
+	uvpInput.m_UvData.m_VertCount = (int)verts.size();
+	uvpInput.m_UvData.m_pVertArray = verts.data();
+
+	UvpOpExecutorT opExecutor(false);
+	UVP_ERRORCODE result = opExecutor.execute(uvpInput);
+
+	switch (result) {
+	case UVP_ERRORCODE::SUCCESS:
+		break;
+	case UVP_ERRORCODE::INVALID_ISLANDS:
+		return UVPACKIT_INVALID_ISLANDS;
+	case UVP_ERRORCODE::NO_SPACE:
+		return UVPACKIT_NO_SPACE;
+	case UVP_ERRORCODE::NO_VALID_STATIC_ISLAND:
+		return UVPACKIT_NO_VALID_STATIC_ISLAND;
+	default:
+		return UVPACKIT_FAILED;
+	}
+
+	const UvpIslandsMessageT* pIslandsMsg = static_cast<const UvpIslandsMessageT*>(opExecutor.getLastMessage(UvpMessageT::MESSAGE_CODE::ISLANDS));
+	const UvpPackSolutionMessageT* pPackSolutionMsg = static_cast<const UvpPackSolutionMessageT*>(opExecutor.getLastMessage(UvpMessageT::MESSAGE_CODE::PACK_SOLUTION));
+	if (!pIslandsMsg || !pPackSolutionMsg)
+		return UVPACKIT_FAILED;
+
+	int island_count = 0;
+	for (const UvpIslandPackSolutionT& islandSolution : pPackSolutionMsg->m_IslandSolutions)
+	{
+		(void)islandSolution;
+		island_count++;
+	}
+	buffers->islandCount = island_count;
+
+	if (buffers->islandTransforms && island_count > buffers->islandCapacity)
+		return UVPACKIT_ISLAND_CAPACITY;
+
+	if (buffers->solvedUvs)
+	{
+		std::vector<LXtFVector2> solved_texcoords;
+		solveTexcoords(pIslandsMsg->m_Islands, pPackSolutionMsg->m_IslandSolutions, faces, verts, solved_texcoords);
+		for (int i = 0; i < buffers->vertCount; i++)
+		{
+			buffers->solvedUvs[2 * i] = solved_texcoords[i][0];
+			buffers->solvedUvs[2 * i + 1] = solved_texcoords[i][1];
+		}
+	}
+
+	if (buffers->faceIsland)
+	{
+		for (int i = 0; i < buffers->faceCount; i++)
+			buffers->faceIsland[i] = -1;
+	}
+
+	int island = 0;
+	for (const UvpIslandPackSolutionT& islandSolution : pPackSolutionMsg->m_IslandSolutions)
+	{
+		if (buffers->islandTransforms)
+		{
+			CLxMatrix4 solutionMatrix;
+			islandSolutionToMatrix(islandSolution, solutionMatrix);
+
+			float* transform = buffers->islandTransforms + 6 * island;
+			for (int row = 0; row < 2; row++)
+			{
+				transform[3 * row] = (float)solutionMatrix[row][0];
+				transform[3 * row + 1] = (float)solutionMatrix[row][1];
+				transform[3 * row + 2] = (float)solutionMatrix[row][3];
+			}
+		}
+
+		if (buffers->faceIsland)
+		{
+			for (int faceId : pIslandsMsg->m_Islands[islandSolution.m_IslandIdx])
+				buffers->faceIsland[faceId] = island;
+		}
+		island++;
+	}
+
+	return UVPACKIT_OK;
+}
+
+UvpackitResultT uvpackitPack(const UvpackitSettingsT* settings, UvpackitBuffersT* buffers)
+{
+	// Allocations and UVP itself may throw,
+	try
+	{
+		return packBuffers(settings, buffers);
+	}
+	catch (...)
+	{
+		return UVPACKIT_FAILED;
+	}
+}
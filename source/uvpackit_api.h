@@ -0,0 +1,103 @@
+#pragma once
+
+// C entry point for packing uvs held in plain arrays, for pipeline tools that
+// would otherwise have to go through the uvp.pack command and a scene. The
+// functions are exported from the plug-in library, so they can be called from
+// Python with ctypes, and run the same pack configuration as uvp.pack.
+//
+// Buffers are owned by the caller and only read during the call, outputs are
+// written in place. Vertices are uv vertices, faces sharing a vertex index
+// belong to the same island.
+
+#ifdef _WIN32
+#ifdef UVPACKIT_EXPORTS
+#define UVPACKIT_API __declspec(dllexport)
+#else
+#define UVPACKIT_API __declspec(dllimport)
+#endif
+#else
+#define UVPACKIT_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Pack settings, the same as the arguments of uvp.pack with the same names.
+typedef struct UvpackitSettingsT
+{
+	int stretch;
+	int orient;
+	float margin;
+	float pixelMargin;
+	float pixelPadding;
+	int pixelMarginTextureSize;
+	int normalizeIslands;
+} UvpackitSettingsT;
+
+// Caller owned input and output buffers for uvpackitPack.
+typedef struct UvpackitBuffersT
+{
+	// vertCount uv pairs and, only needed with normalizeIslands, vertCount
+	// 3d positions. positions may be NULL otherwise.
+	const float* uvs;
+	const float* positions;
+	int vertCount;
+
+	// Vertex indices of all faces back to back, cornerCount in total, and the
+	// number of corners of each of the faceCount faces.
+	const int* faceIndices;
+	int cornerCount;
+	const int* faceSizes;
+	int faceCount;
+
+	// Optional, a non zero value per face marks it selected. Unselected
+	// islands stay in place and the selected ones are packed around them.
+	// NULL packs every face.
+	const unsigned char* faceSelected;
+
+	// Optional, vertCount uv pairs receiving the solved uvs. Vertices of
+	// islands that are not moved get their input uvs.
+	float* solvedUvs;
+
+	// Optional, the transform of every packed island as a 2x3 row major affine
+	// matrix, u' = m[0] u + m[1] v + m[2] and v' = m[3] u + m[4] v + m[5].
+	// islandCapacity is the number of matrices islandTransforms has room for,
+	// faceCount is always enough.
+	float* islandTransforms;
+	int islandCapacity;
+
+	// Optional, faceCount values receiving the packed island of every face,
+	// or -1 for faces that are not moved.
+	int* faceIsland;
+
+	// Set to the number of packed islands,
+	int islandCount;
+} UvpackitBuffersT;
+
+typedef enum UvpackitResultT
+{
+	UVPACKIT_OK = 0,
+	UVPACKIT_INVALID_ARGUMENT,
+	UVPACKIT_INVALID_INPUT,
+	UVPACKIT_INVALID_ISLANDS,
+	UVPACKIT_NO_SPACE,
+	UVPACKIT_NO_VALID_STATIC_ISLAND,
+	UVPACKIT_ISLAND_CAPACITY,
+	UVPACKIT_FAILED
+} UvpackitResultT;
+
+// Fill settings with the defaults of uvp.pack,
+UVPACKIT_API void uvpackitDefaultSettings(UvpackitSettingsT* settings);
+
+// Pack the uvs in buffers, blocking until done. Returns
+// UVPACKIT_INVALID_ARGUMENT if faceSizes doesn't add up to cornerCount,
+// UVPACKIT_INVALID_INPUT for uv data that fails the same validation as
+// uvp.pack, UVPACKIT_ISLAND_CAPACITY, with islandCount set and no outputs
+// written, if islandTransforms is too small, and UVPACKIT_FAILED if the pack
+// fails or runs out of memory.
+UVPACKIT_API UvpackitResultT uvpackitPack(const UvpackitSettingsT* settings, UvpackitBuffersT* buffers);
+
+#ifdef __cplusplus
+}
+#endif
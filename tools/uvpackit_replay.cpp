@@ -0,0 +1,362 @@
+// Replays a pack captured by uvp.pack with the capture argument, outside of
+// Modo. Useful for profiling UVP on real production data and for reproducing
+// failing packs. Grouped, hierarchical and sweep packs are split up and run
+// concurrently the same way uvp.pack does.
+//
+// usage: uvpackit_replay <capture file> [--repeat <n>] [--validate]
+//
+// --validate checks the input with validateUvData and UVP's own validation,
+// which makes the reported pack time less useful for profiling.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <future>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "uvp_capture.hpp"
+#include "uvp_executor.hpp"
+#include "uvp_stages.hpp"
+
+// Read only memory mapping of a file,
+class FileMapT
+{
+	const char* m_Data = nullptr;
+	uint64_t m_Size = 0;
+
+#ifdef _WIN32
+	HANDLE m_File = INVALID_HANDLE_VALUE;
+	HANDLE m_Mapping = NULL;
+#endif
+
+public:
+	FileMapT() {}
+	FileMapT(const FileMapT&) = delete;
+	FileMapT& operator=(const FileMapT&) = delete;
+
+	~FileMapT()
+	{
+#ifdef _WIN32
+		if (m_Data)
+			UnmapViewOfFile(m_Data);
+		if (m_Mapping != NULL)
+			CloseHandle(m_Mapping);
+		if (m_File != INVALID_HANDLE_VALUE)
+			CloseHandle(m_File);
+#else
+		if (m_Data)
+			munmap(const_cast<char*>(m_Data), (size_t)m_Size);
+#endif
+	}
+
+	bool open(const char* path)
+	{
+#ifdef _WIN32
+		m_File = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (m_File == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_File, &size) || size.QuadPart == 0)
+			return false;
+		m_Size = (uint64_t)size.QuadPart;
+
+		m_Mapping = CreateFileMappingA(m_File, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_Mapping == NULL)
+			return false;
+
+		m_Data = static_cast<const char*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+		m_Size = (uint64_t)info.st_size;
+
+		void* data = mmap(nullptr, (size_t)m_Size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		m_Data = data == MAP_FAILED ? nullptr : static_cast<const char*>(data);
+#endif
+		return m_Data != nullptr;
+	}
+
+	const char* data() const { return m_Data; }
+	uint64_t size() const { return m_Size; }
+};
+
+const char* errorName(UVP_ERRORCODE code)
+{
+	switch (code) {
+	case UVP_ERRORCODE::SUCCESS: return "SUCCESS";
+	case UVP_ERRORCODE::CANCELLED: return "CANCELLED";
+	case UVP_ERRORCODE::INVALID_ISLANDS: return "INVALID_ISLANDS";
+	case UVP_ERRORCODE::NO_SPACE: return "NO_SPACE";
+	case UVP_ERRORCODE::NO_VALID_STATIC_ISLAND: return "NO_VALID_STATIC_ISLAND";
+	default: return "FAILED";
+	}
+}
+
+// Run the operations concurrently, at most one per hardware thread, the same as
+// CCommand::runOperations. Exceptions are printed and count as failures, as do
+// operations that didn't send a solution.
+std::vector<UVP_ERRORCODE> runOperations(std::vector<UvpOperationInputT>& inputs, std::vector<std::unique_ptr<UvpOpExecutorT>>& executors, bool validate)
+{
+	const int count = (int)inputs.size();
+
+	executors.clear();
+	for (int i = 0; i < count; i++)
+		executors.emplace_back(new UvpOpExecutorT(validate));
+
+	std::vector<UVP_ERRORCODE> results(count, UVP_ERRORCODE::GENERAL_ERROR);
+	std::vector<std::string> exceptions(count);
+	std::atomic_int next = 0;
+
+	auto worker = [&]()
+	{
+		for (int i = next++; i < count; i = next++)
+		{
+			try
+			{
+				results[i] = executors[i]->execute(inputs[i]);
+			}
+			catch (const std::exception & ex)
+			{
+				exceptions[i] = ex.what();
+			}
+		}
+	};
+
+	unsigned worker_count = std::min((unsigned)count, std::max(1u, std::thread::hardware_concurrency()));
+	std::vector<std::future<void>> futures;
+	for (unsigned i = 0; i < worker_count; i++)
+		futures.push_back(std::async(std::launch::async, worker));
+	for (auto& future : futures)
+		future.get();
+
+	for (int i = 0; i < count; i++)
+	{
+		if (!exceptions[i].empty())
+			std::printf("%s\n", exceptions[i].c_str());
+
+		if (results[i] == UVP_ERRORCODE::SUCCESS &&
+			(!executors[i]->getLastMessage(UvpMessageT::MESSAGE_CODE::ISLANDS) || !executors[i]->getLastMessage(UvpMessageT::MESSAGE_CODE::PACK_SOLUTION)))
+			results[i] = UVP_ERRORCODE::GENERAL_ERROR;
+	}
+
+	return results;
+}
+
+// Apply the solution of a successful operation to solved_texcoords,
+void applySolution(UvpOpExecutorT& executor, const std::vector<UvFaceT>& faces, const std::vector<UvVertT>& verts, std::vector<LXtFVector2>& solved_texcoords)
+{
+	const UvpIslandsMessageT* pIslandsMsg = static_cast<const UvpIslandsMessageT*>(executor.getLastMessage(UvpMessageT::MESSAGE_CODE::ISLANDS));
+	const UvpPackSolutionMessageT* pPackSolutionMsg = static_cast<const UvpPackSolutionMessageT*>(executor.getLastMessage(UvpMessageT::MESSAGE_CODE::PACK_SOLUTION));
+
+	applyIslandSolutions(pIslandsMsg->m_Islands, pPackSolutionMsg->m_IslandSolutions, faces, verts, solved_texcoords);
+}
+
+// The first failure of several operations, or SUCCESS,
+UVP_ERRORCODE firstFailure(const std::vector<UVP_ERRORCODE>& results)
+{
+	for (UVP_ERRORCODE result : results)
+		if (result != UVP_ERRORCODE::SUCCESS)
+			return result;
+	return UVP_ERRORCODE::SUCCESS;
+}
+
+// Pack the partitions and then their boxes, see CCommand::packPartitions.
+UVP_ERRORCODE packPartitions(const UvpOperationInputT& baseInput, const UvPartitionT& partition, bool validate)
+{
+	const std::vector<double> sizes = partitionSizes(partition, baseInput.m_NormalizeIslands);
+
+	std::vector<UvpOperationInputT> inputs;
+	partitionInputs(baseInput, partition, sizes, inputs);
+
+	std::vector<std::unique_ptr<UvpOpExecutorT>> executors;
+	UVP_ERRORCODE result = firstFailure(runOperations(inputs, executors, validate));
+	if (result != UVP_ERRORCODE::SUCCESS)
+		return result;
+
+	std::vector<std::vector<LXtFVector2>> part_texcoords(partition.m_Parts.size());
+	for (size_t i = 0; i < partition.m_Parts.size(); i++)
+	{
+		const UvCompactT& part = partition.m_Parts[i];
+		initTexcoords(part.m_VertArray, part_texcoords[i]);
+		applySolution(*executors[i], part.m_FaceArray, part.m_VertArray, part_texcoords[i]);
+	}
+
+	equalizePartitionDensity(partition, sizes, part_texcoords);
+
+	std::vector<UvVertT> box_verts;
+	std::vector<UvFaceT> box_faces;
+	partitionBoxes(partition, part_texcoords, box_verts, box_faces);
+
+	std::vector<UvpOperationInputT> box_input(1, partitionBoxInput(baseInput, partition, box_verts, box_faces));
+	std::vector<std::unique_ptr<UvpOpExecutorT>> box_executor;
+	return firstFailure(runOperations(box_input, box_executor, validate));
+}
+
+// Pack every sweep variant and print how each of them did, see
+// CCommand::packSweep. Only fails if every variant failed.
+UVP_ERRORCODE packSweep(const UvpOperationInputT& baseInput, int count, int metric, const std::vector<UvFaceT>& faces, const std::vector<UvVertT>& verts, bool validate)
+{
+	std::vector<UvpOperationInputT> inputs = sweepVariants(baseInput, count, metric == SWEEP_SCALE);
+	std::vector<std::unique_ptr<UvpOpExecutorT>> executors;
+	std::vector<UVP_ERRORCODE> results = runOperations(inputs, executors, validate);
+
+	const bool selected_only = baseInput.m_ProcessUnselected;
+	const double input_area = uvArea(faces, verts, nullptr, selected_only);
+
+	int best = -1;
+	double best_score = 0.0;
+	std::vector<LXtFVector2> variant_texcoords;
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		if (results[i] != UVP_ERRORCODE::SUCCESS)
+		{
+			std::printf("  variant %zu: %s\n", i + 1, errorName(results[i]));
+			continue;
+		}
+
+		initTexcoords(verts, variant_texcoords);
+		applySolution(*executors[i], faces, verts, variant_texcoords);
+
+		double score = sweepScore(metric, faces, verts, variant_texcoords, selected_only, input_area);
+		std::printf("  variant %zu: %s %f\n", i + 1, metric == SWEEP_SCALE ? "scale" : "coverage", score);
+		if (best < 0 || score > best_score)
+		{
+			best = (int)i;
+			best_score = score;
+		}
+	}
+
+	return best < 0 ? firstFailure(results) : UVP_ERRORCODE::SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+	const char* path = nullptr;
+	unsigned repeat = 1;
+	bool validate = false;
+	bool usage = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!std::strcmp(argv[i], "--repeat") && i + 1 < argc)
+			repeat = std::max(1, std::atoi(argv[++i]));
+		else if (!std::strcmp(argv[i], "--validate"))
+			validate = true;
+		else if (!path && argv[i][0] != '-')
+			path = argv[i];
+		else
+			usage = true;
+	}
+
+	if (!path || usage)
+	{
+		std::printf("usage: %s <capture file> [--repeat <n>] [--validate]\n", argv[0]);
+		return 2;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	FileMapT file;
+	if (!file.open(path))
+	{
+		std::printf("%s: could not map file\n", path);
+		return 2;
+	}
+
+	UvpOperationInputT uvpInput;
+	UvpCaptureModeT mode;
+	std::vector<UvVertT> verts;
+	std::vector<UvFaceT> faces;
+	std::vector<int> face_group;
+	if (const char* error = readCapture(file.data(), file.size(), uvpInput, mode, verts, faces, face_group))
+	{
+		std::printf("%s: %s\n", path, error);
+		return 2;
+	}
+
+	std::chrono::duration<double, std::milli> load_time = std::chrono::steady_clock::now() - start;
+
+	const UvpCaptureHeaderT& header = *reinterpret_cast<const UvpCaptureHeaderT*>(file.data());
+	std::printf("%s: %zu faces, %zu verts, loaded in %.1f ms\n", path, faces.size(), verts.size(), load_time.count());
+	std::printf("captured timing: gather %.1f ms, validate %.1f ms, pack %.1f ms, write %.1f ms (negative if not finished)\n",
+		header.m_Timing.m_GatherMs, header.m_Timing.m_ValidateMs, header.m_Timing.m_PackMs, header.m_Timing.m_WriteMs);
+
+	if (mode.m_SweepCount > 1)
+		std::printf("mode: sweep of %d variants\n", mode.m_SweepCount);
+	else if (mode.m_ClusterCount > 0)
+		std::printf("mode: hierarchical in %d clusters\n", mode.m_ClusterCount);
+	else if (mode.m_GroupMode != 0)
+		std::printf("mode: grouped by mode %d in %d groups\n", mode.m_GroupMode, mode.m_GroupCount);
+	else
+		std::printf("mode: single pack\n");
+
+	if (validate)
+	{
+		UvDataIssuesT issues = validateUvData(verts, faces);
+		std::printf("validation: %zu bad index, %zu non finite, %zu duplicate corner, %zu degenerate\n",
+			issues.m_BadIndex.size(), issues.m_NonFinite.size(), issues.m_DuplicateCorner.size(), issues.m_Degenerate.size());
+	}
+
+	int exit_code = 0;
+	for (unsigned i = 0; i < repeat; i++)
+	{
+		// --validate also runs UVP's own, slow, input validation before packing
+		start = std::chrono::steady_clock::now();
+		UVP_ERRORCODE result = UVP_ERRORCODE::GENERAL_ERROR;
+		if (mode.m_SweepCount > 1)
+		{
+			result = packSweep(uvpInput, mode.m_SweepCount, mode.m_SweepMetric, faces, verts, validate);
+		}
+		else if (mode.m_ClusterCount > 0 || mode.m_GroupMode != 0)
+		{
+			// Partitioned the same way as by uvp.pack, which counts towards the pack
+			UvPartitionT partition;
+			if (mode.m_ClusterCount > 0)
+				clusterIslands(verts, faces, findIslands(verts, faces), mode.m_ClusterCount, partition);
+			else
+				partitionGroups(verts, faces, face_group, mode.m_GroupCount, partition);
+
+			result = packPartitions(uvpInput, partition, validate);
+		}
+		else
+		{
+			std::vector<UvpOperationInputT> inputs(1, uvpInput);
+			std::vector<std::unique_ptr<UvpOpExecutorT>> executors;
+			result = runOperations(inputs, executors, validate)[0];
+		}
+		std::chrono::duration<double, std::milli> pack_time = std::chrono::steady_clock::now() - start;
+
+		std::printf("run %u: %s in %.1f ms\n", i + 1, errorName(result), pack_time.count());
+
+		if (result != UVP_ERRORCODE::SUCCESS)
+			exit_code = 1;
+	}
+
+	return exit_code;
+}